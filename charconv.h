@@ -0,0 +1,529 @@
+#ifndef __SEAL_CHARCONV_H__
+#define __SEAL_CHARCONV_H__
+
+#include <limits>
+#include <string>
+#include <type_traits>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <locale.h>
+
+
+namespace sea {
+
+namespace charconv_impl {
+
+static constexpr char digit_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+inline int count_digits(uint64_t v) {
+	int n = 1;
+	while ( true ) {
+		if ( v < 10 ) return n;
+		if ( v < 100 ) return n + 1;
+		if ( v < 1000 ) return n + 2;
+		if ( v < 10000 ) return n + 3;
+		v /= 10000;
+		n += 4;
+	}
+}
+
+inline char *write_uint(char *p, uint64_t v) {
+	int n = count_digits(v);
+	char *e = p + n;
+	while ( v >= 100 ) {
+		size_t i = (size_t)(v % 100) * 2;
+		v /= 100;
+		*--e = digit_pairs[i + 1];
+		*--e = digit_pairs[i];
+	}
+	if ( v >= 10 ) {
+		*--e = digit_pairs[v * 2 + 1];
+		*--e = digit_pairs[v * 2];
+	} else {
+		*--e = (char)('0' + v);
+	}
+	return p + n;
+}
+
+
+// Grisu2, Florian Loitsch, "Printing Floating-Point Numbers Quickly and
+// Accurately with Integers", PLDI 2010. The digits always read back to the
+// same value and are the shortest such string in all but rare cases.
+
+struct diyfp {
+	uint64_t f;
+	int e;
+
+	static diyfp sub(diyfp x, diyfp y) { return {x.f - y.f, x.e}; }
+
+	// the high half of the product, rounded
+	static diyfp mul(diyfp x, diyfp y) {
+#ifdef __SIZEOF_INT128__
+		__extension__ typedef unsigned __int128 uint128;
+		uint128 p = (uint128)x.f * y.f;
+		uint64_t h = (uint64_t)(p >> 64);
+		h += ((uint64_t)p >> 63) & 1;
+#else
+		static constexpr uint64_t M32 = 0xffffffffu;
+		uint64_t a = x.f >> 32, b = x.f & M32, c = y.f >> 32, d = y.f & M32;
+		uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+		uint64_t t = (bd >> 32) + (ad & M32) + (bc & M32) + (1u << 31);
+		uint64_t h = ac + (ad >> 32) + (bc >> 32) + (t >> 32);
+#endif
+		return {h, x.e + y.e + 64};
+	}
+
+	static diyfp normalize(diyfp x) {
+		int s = __builtin_clzll(x.f);
+		return {x.f << s, x.e - s};
+	}
+
+	static diyfp normalize_to(diyfp x, int e) {
+		return {x.f << (x.e - e), e};
+	}
+};
+
+struct boundaries {
+	diyfp w, minus, plus;
+};
+
+template <typename F, typename U>
+boundaries compute_boundaries(F value) {
+	static constexpr int P = std::numeric_limits<F>::digits;
+	static constexpr int B = std::numeric_limits<F>::max_exponent - 1 + (P - 1);
+	static constexpr uint64_t H = (uint64_t)1 << (P - 1);
+
+	U bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint64_t f = bits & (H - 1);
+	int e = (int)(bits >> (P - 1));
+
+	diyfp v = e == 0 ? diyfp{f, 1 - B} : diyfp{f + H, e - B};
+	bool closer = f == 0 && e > 1;
+	diyfp plus = {2 * v.f + 1, v.e - 1};
+	diyfp minus = closer ? diyfp{4 * v.f - 1, v.e - 2} : diyfp{2 * v.f - 1, v.e - 1};
+
+	plus = diyfp::normalize(plus);
+	return {diyfp::normalize(v), diyfp::normalize_to(minus, plus.e), plus};
+}
+
+struct cached_power {
+	uint64_t f;
+	int e;
+	int k;
+};
+
+inline cached_power get_cached_power(int e) {
+	static constexpr int ALPHA = -60;
+	static constexpr int MIN_EXP = -300;
+	static constexpr int STEP = 8;
+	static constexpr cached_power powers[] = {
+		{0xAB70FE17C79AC6CA, -1060, -300},
+		{0xFF77B1FCBEBCDC4F, -1034, -292},
+		{0xBE5691EF416BD60C, -1007, -284},
+		{0x8DD01FAD907FFC3C,  -980, -276},
+		{0xD3515C2831559A83,  -954, -268},
+		{0x9D71AC8FADA6C9B5,  -927, -260},
+		{0xEA9C227723EE8BCB,  -901, -252},
+		{0xAECC49914078536D,  -874, -244},
+		{0x823C12795DB6CE57,  -847, -236},
+		{0xC21094364DFB5637,  -821, -228},
+		{0x9096EA6F3848984F,  -794, -220},
+		{0xD77485CB25823AC7,  -768, -212},
+		{0xA086CFCD97BF97F4,  -741, -204},
+		{0xEF340A98172AACE5,  -715, -196},
+		{0xB23867FB2A35B28E,  -688, -188},
+		{0x84C8D4DFD2C63F3B,  -661, -180},
+		{0xC5DD44271AD3CDBA,  -635, -172},
+		{0x936B9FCEBB25C996,  -608, -164},
+		{0xDBAC6C247D62A584,  -582, -156},
+		{0xA3AB66580D5FDAF6,  -555, -148},
+		{0xF3E2F893DEC3F126,  -529, -140},
+		{0xB5B5ADA8AAFF80B8,  -502, -132},
+		{0x87625F056C7C4A8B,  -475, -124},
+		{0xC9BCFF6034C13053,  -449, -116},
+		{0x964E858C91BA2655,  -422, -108},
+		{0xDFF9772470297EBD,  -396, -100},
+		{0xA6DFBD9FB8E5B88F,  -369,  -92},
+		{0xF8A95FCF88747D94,  -343,  -84},
+		{0xB94470938FA89BCF,  -316,  -76},
+		{0x8A08F0F8BF0F156B,  -289,  -68},
+		{0xCDB02555653131B6,  -263,  -60},
+		{0x993FE2C6D07B7FAC,  -236,  -52},
+		{0xE45C10C42A2B3B06,  -210,  -44},
+		{0xAA242499697392D3,  -183,  -36},
+		{0xFD87B5F28300CA0E,  -157,  -28},
+		{0xBCE5086492111AEB,  -130,  -20},
+		{0x8CBCCC096F5088CC,  -103,  -12},
+		{0xD1B71758E219652C,   -77,   -4},
+		{0x9C40000000000000,   -50,    4},
+		{0xE8D4A51000000000,   -24,   12},
+		{0xAD78EBC5AC620000,     3,   20},
+		{0x813F3978F8940984,    30,   28},
+		{0xC097CE7BC90715B3,    56,   36},
+		{0x8F7E32CE7BEA5C70,    83,   44},
+		{0xD5D238A4ABE98068,   109,   52},
+		{0x9F4F2726179A2245,   136,   60},
+		{0xED63A231D4C4FB27,   162,   68},
+		{0xB0DE65388CC8ADA8,   189,   76},
+		{0x83C7088E1AAB65DB,   216,   84},
+		{0xC45D1DF942711D9A,   242,   92},
+		{0x924D692CA61BE758,   269,  100},
+		{0xDA01EE641A708DEA,   295,  108},
+		{0xA26DA3999AEF774A,   322,  116},
+		{0xF209787BB47D6B85,   348,  124},
+		{0xB454E4A179DD1877,   375,  132},
+		{0x865B86925B9BC5C2,   402,  140},
+		{0xC83553C5C8965D3D,   428,  148},
+		{0x952AB45CFA97A0B3,   455,  156},
+		{0xDE469FBD99A05FE3,   481,  164},
+		{0xA59BC234DB398C25,   508,  172},
+		{0xF6C69A72A3989F5C,   534,  180},
+		{0xB7DCBF5354E9BECE,   561,  188},
+		{0x88FCF317F22241E2,   588,  196},
+		{0xCC20CE9BD35C78A5,   614,  204},
+		{0x98165AF37B2153DF,   641,  212},
+		{0xE2A0B5DC971F303A,   667,  220},
+		{0xA8D9D1535CE3B396,   694,  228},
+		{0xFB9B7CD9A4A7443C,   720,  236},
+		{0xBB764C4CA7A44410,   747,  244},
+		{0x8BAB8EEFB6409C1A,   774,  252},
+		{0xD01FEF10A657842C,   800,  260},
+		{0x9B10A4E5E9913129,   827,  268},
+		{0xE7109BFBA19C0C9D,   853,  276},
+		{0xAC2820D9623BF429,   880,  284},
+		{0x80444B5E7AA7CF85,   907,  292},
+		{0xBF21E44003ACDD2D,   933,  300},
+		{0x8E679C2F5E44FF8F,   960,  308},
+		{0xD433179D9C8CB841,   986,  316},
+		{0x9E19DB92B4E31BA9,  1013,  324},
+	};
+
+	int f = ALPHA - e - 1;
+	int k = (f * 78913) / (1 << 18) + (f > 0);
+	return powers[(-MIN_EXP + k + (STEP - 1)) / STEP];
+}
+
+inline void grisu2_round(char *buf, int len, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t ten_k) {
+	while ( rest < dist && delta - rest >= ten_k
+			&& (rest + ten_k < dist || dist - rest > rest + ten_k - dist) ) {
+		--buf[len - 1];
+		rest += ten_k;
+	}
+}
+
+inline void grisu2_digit_gen(char *buf, int &len, int &dexp, diyfp minus, diyfp w, diyfp plus) {
+	uint64_t delta = diyfp::sub(plus, minus).f;
+	uint64_t dist = diyfp::sub(plus, w).f;
+
+	int s = -plus.e;
+	uint64_t one = (uint64_t)1 << s;
+	uint32_t p1 = (uint32_t)(plus.f >> s);
+	uint64_t p2 = plus.f & (one - 1);
+
+	uint32_t pow10 = 1;
+	int n = 1;
+	while ( n < 10 && p1 / pow10 >= 10 ) {
+		pow10 *= 10;
+		++n;
+	}
+
+	while ( n > 0 ) {
+		buf[len++] = (char)('0' + p1 / pow10);
+		p1 %= pow10;
+		--n;
+		uint64_t rest = ((uint64_t)p1 << s) + p2;
+		if ( rest <= delta ) {
+			dexp += n;
+			grisu2_round(buf, len, dist, delta, rest, (uint64_t)pow10 << s);
+			return;
+		}
+		pow10 /= 10;
+	}
+
+	int m = 0;
+	while ( true ) {
+		p2 *= 10;
+		buf[len++] = (char)('0' + (p2 >> s));
+		p2 &= one - 1;
+		++m;
+		delta *= 10;
+		dist *= 10;
+		if ( p2 <= delta ) break;
+	}
+	dexp -= m;
+	grisu2_round(buf, len, dist, delta, p2, one);
+}
+
+template <typename F, typename U>
+int grisu2(char *buf, int &dexp, F value) {
+	boundaries b = compute_boundaries<F, U>(value);
+	cached_power c = get_cached_power(b.plus.e);
+	diyfp ck = {c.f, c.e};
+	diyfp w = diyfp::mul(b.w, ck);
+	diyfp minus = diyfp::mul(b.minus, ck);
+	diyfp plus = diyfp::mul(b.plus, ck);
+	int len = 0;
+	dexp = -c.k;
+	grisu2_digit_gen(buf, len, dexp, {minus.f + 1, minus.e}, w, {plus.f - 1, plus.e});
+	return len;
+}
+
+// lays out the digits the way printf's %g does, minus its precision limit
+inline char *format_digits(char *p, const char *d, int len, int dexp, int maxexp) {
+	int n = len + dexp;
+	if ( len <= n && n <= maxexp ) {
+		memcpy(p, d, len);
+		memset(p + len, '0', n - len);
+		return p + n;
+	} else if ( 0 < n && n <= maxexp ) {
+		memcpy(p, d, n);
+		p[n] = '.';
+		memcpy(p + n + 1, d + n, len - n);
+		return p + len + 1;
+	} else if ( -4 < n && n <= 0 ) {
+		*p++ = '0';
+		*p++ = '.';
+		memset(p, '0', -n);
+		memcpy(p - n, d, len);
+		return p - n + len;
+	}
+	*p++ = d[0];
+	if ( len > 1 ) {
+		*p++ = '.';
+		memcpy(p, d + 1, len - 1);
+		p += len - 1;
+	}
+	int x = n - 1;
+	*p++ = 'e';
+	*p++ = x < 0 ? '-' : '+';
+	x = x < 0 ? -x : x;
+	if ( x < 10 ) *p++ = '0';
+	return write_uint(p, (uint64_t)x);
+}
+
+template <typename F, typename U>
+char *write_float(char *p, F v) {
+	U bits;
+	memcpy(&bits, &v, sizeof(bits));
+	if ( bits >> (sizeof(U) * 8 - 1) ) {
+		*p++ = '-';
+		v = -v;
+	}
+	if ( v != v ) {
+		memcpy(p, "nan", 3);
+		return p + 3;
+	} else if ( v == std::numeric_limits<F>::infinity() ) {
+		memcpy(p, "inf", 3);
+		return p + 3;
+	} else if ( v == 0 ) {
+		*p = '0';
+		return p + 1;
+	}
+	char d[24];
+	int dexp;
+	int len = grisu2<F, U>(d, dexp, v);
+	return format_digits(p, d, len, dexp, std::numeric_limits<F>::max_digits10);
+}
+
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+// SWAR check and conversion of eight ASCII digits loaded as one word
+inline bool is_8digits(uint64_t x) {
+	return ((x & 0xF0F0F0F0F0F0F0F0) | (((x + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4))
+		== 0x3333333333333333;
+}
+
+inline uint32_t parse_8digits(uint64_t x) {
+	x -= 0x3030303030303030;
+	x = x * 10 + (x >> 8);
+	x = ((x & 0x000000FF000000FF) * (100 + (1000000ULL << 32))
+		+ ((x >> 16) & 0x000000FF000000FF) * (1 + (10000ULL << 32))) >> 32;
+	return (uint32_t)x;
+}
+#endif
+
+// accumulates digits at p into v, nd counts them, stops at overflow
+inline const char *read_digits(const char *p, const char *e, uint64_t &v, int &nd) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint64_t x;
+	while ( e - p >= 8 && v < 100000000000ULL ) {
+		memcpy(&x, p, 8);
+		if ( !is_8digits(x) ) break;
+		v = v * 100000000 + parse_8digits(x);
+		nd += 8;
+		p += 8;
+	}
+#endif
+	while ( p != e && (unsigned)(*p - '0') < 10 ) {
+		if ( __builtin_mul_overflow(v, 10, &v) || __builtin_add_overflow(v, (uint64_t)(*p - '0'), &v) ) {
+			nd = -1;
+			return p;
+		}
+		++nd;
+		++p;
+	}
+	return p;
+}
+
+inline locale_t c_locale() {
+	static locale_t l = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+	return l;
+}
+
+// strtod() would skip leading white space, from_chars never does
+inline const char *strtod_range(const char *b, const char *e, double &v) {
+	if ( b == e || *b == ' ' || (unsigned)(*b - '\t') <= '\r' - '\t' ) return b;
+	char buf[64];
+	std::string s;
+	size_t n = e - b;
+	const char *p = buf;
+	if ( n < sizeof(buf) ) {
+		memcpy(buf, b, n);
+		buf[n] = '\0';
+	} else {
+		s.assign(b, e);
+		p = s.data();
+	}
+	char *r;
+	double d = strtod_l(p, &r, c_locale());
+	if ( r == p ) return b;
+	v = d;
+	return b + (r - p);
+}
+
+}
+
+
+// Parses the number at the start of [b, e), independent of the locale and
+// without skipping white space before it. Returns the end of the parsed text, or b when there is no number there or
+// it does not fit in v, leaving v untouched.
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value, const char *>::type
+from_chars(const char *b, const char *e, T &v) {
+	typedef typename std::make_unsigned<T>::type U;
+	const char *p = b;
+	bool neg = false;
+	if ( p != e && (*p == '-' || *p == '+') ) {
+		neg = *p++ == '-';
+		if ( neg && !std::is_signed<T>::value ) return b;
+	}
+	uint64_t u = 0;
+	int nd = 0;
+	p = charconv_impl::read_digits(p, e, u, nd);
+	uint64_t m = (uint64_t)(U)std::numeric_limits<T>::max() + neg;
+	if ( nd <= 0 || u > m ) return b;
+	v = neg ? (T)(U)(0 - u) : (T)u;
+	return p;
+}
+
+inline const char *from_chars(const char *b, const char *e, double &v) {
+	static constexpr double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+	};
+	const char *p = b;
+	bool neg = p != e && *p == '-';
+	if ( p != e && (*p == '-' || *p == '+') ) ++p;
+	if ( p == e || ((unsigned)(*p - '0') >= 10 && *p != '.') ) {
+		return charconv_impl::strtod_range(b, e, v);
+	}
+
+	uint64_t m = 0;
+	int nd = 0, nf = 0;
+	p = charconv_impl::read_digits(p, e, m, nd);
+	if ( nd >= 0 && p != e && *p == '.' ) {
+		const char *f = p + 1;
+		p = charconv_impl::read_digits(f, e, m, nd);
+		nf = (int)(p - f);
+	}
+	if ( nd < 0 ) {
+		return charconv_impl::strtod_range(b, e, v);
+	} else if ( nd == 0 ) {
+		return b;
+	}
+
+	int x = 0;
+	if ( p != e && (*p == 'e' || *p == 'E') ) {
+		const char *q = p + 1;
+		bool xn = q != e && *q == '-';
+		if ( q != e && (*q == '-' || *q == '+') ) ++q;
+		uint64_t u = 0;
+		int xd = 0;
+		q = charconv_impl::read_digits(q, e, u, xd);
+		if ( xd < 0 || u > 100000 ) {
+			return charconv_impl::strtod_range(b, e, v);
+		} else if ( xd > 0 ) {
+			x = xn ? -(int)u : (int)u;
+			p = q;
+		}
+	}
+	x -= nf;
+
+	// exact when both the mantissa and the power of ten are doubles
+	if ( m <= ((uint64_t)1 << 53) && -22 <= x && x <= 22 ) {
+		double d = (double)m;
+		d = x < 0 ? d / pow10[-x] : d * pow10[x];
+		v = neg ? -d : d;
+		return p;
+	}
+	double d;
+	if ( charconv_impl::strtod_range(b, p, d) != p ) return b;
+	v = d;
+	return p;
+}
+
+inline const char *from_chars(const char *b, const char *e, float &v) {
+	double d;
+	const char *p = from_chars(b, e, d);
+	if ( p != b ) v = (float)d;
+	return p;
+}
+
+
+// Writes the text of v at p and returns its end, nothing is terminated.
+// p must have room for to_chars_max bytes.
+static constexpr size_t to_chars_max = 32;
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value, char *>::type
+to_chars(char *p, T v) {
+	return charconv_impl::write_uint(p, v);
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, char *>::type
+to_chars(char *p, T v) {
+	uint64_t u = (uint64_t)(int64_t)v;
+	if ( v < 0 ) {
+		*p++ = '-';
+		u = 0 - u;
+	}
+	return charconv_impl::write_uint(p, u);
+}
+
+inline char *to_chars(char *p, double v) {
+	return charconv_impl::write_float<double, uint64_t>(p, v);
+}
+
+inline char *to_chars(char *p, float v) {
+	return charconv_impl::write_float<float, uint32_t>(p, v);
+}
+
+}
+
+#endif // __SEAL_CHARCONV_H__
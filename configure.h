@@ -8,7 +8,10 @@
 #include "iters.h"
 
 #include <functional>
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <cstdio>
 #include <cstring>
@@ -77,22 +80,29 @@ public:
 };
 
 template <typename R> struct mapped_argument : public base_argument {
+public:
+	typedef base_argument base_type;
+	typedef R resource_type;
+	typedef perfect_map<std::string, R> map_type;
+
 private:
 	R &_val;
-	hash_map<std::string, R> _expect;
+	std::shared_ptr<const map_type> _expect;
 
 public:
-	typedef base_argument base_type;
-	typedef R resource_type;
+	// the table can be shared by every argument built from the same mapping
+	mapped_argument(const std::string &n, R &v, std::shared_ptr<const map_type> m):
+		base_type(n, false), _val(v), _expect(std::move(m)) {}
 
-	template <typename M>
+	template <typename M, typename = typename std::enable_if<
+		!std::is_same<typename std::decay<M>::type, std::shared_ptr<const map_type>>::value>::type>
 	mapped_argument(const std::string &n, R &v, M &&m):
-		base_type(n, false), _val(v), _expect(std::forward<M>(m)) {}
+		base_type(n, false), _val(v), _expect(std::make_shared<const map_type>(std::forward<M>(m))) {}
 
 	bool process_impl() override {
-		auto f = _expect.find(_argv);
-		if ( f == _expect.end() ) {
-			raise(unexpected(_name, _argv, key_cview(_expect)));
+		auto f = _expect->find(_argv);
+		if ( f == _expect->end() ) {
+			raise(unexpected(_name, _argv, key_cview(*_expect)));
 			return false;
 		}
 		_val = f->second;
@@ -161,17 +171,40 @@ struct value_convertor {
 	double convert(const char *s, double) const { return atof(s); }
 };
 
+template <typename R>
+void push_pairs(std::vector<std::pair<std::string, R>> &) {}
+
+template <typename R, typename K, typename V, typename ... Ps>
+void push_pairs(std::vector<std::pair<std::string, R>> &d, K &&k, V &&v, Ps &&... ps) {
+	d.emplace_back(std::forward<K>(k), std::forward<V>(v));
+	push_pairs(d, std::forward<Ps>(ps)...);
+}
+
 inline namespace pub {
 
+// builds the table of make_mapped_arg once, to be shared by every argument
+// made from the same key, value, key, value ... list
 template <typename R, typename ... Ps>
+std::shared_ptr<const typename mapped_argument<R>::map_type> make_mapped_table(Ps &&... ps) {
+	typedef typename mapped_argument<R>::map_type map_type;
+	std::vector<std::pair<std::string, R>> d;
+	d.reserve(sizeof...(Ps) / 2);
+	push_pairs(d, std::forward<Ps>(ps)...);
+	return std::make_shared<const map_type>(std::move(d));
+}
+
+template <typename R>
 mapped_argument<R>
-make_mapped_arg(const std::string &n, R &v, Ps &&... ps) {
-	hash_map<std::string, R> m;
-	auto f = map_inserter<hash_map<std::string, R>>(m);
-	f(std::forward<Ps>(ps)...);
+make_mapped_arg(const std::string &n, R &v, std::shared_ptr<const typename mapped_argument<R>::map_type> m) {
 	return mapped_argument<R>(n, v, std::move(m));
 }
 
+template <typename R, typename ... Ps>
+mapped_argument<R>
+make_mapped_arg(const std::string &n, R &v, Ps &&... ps) {
+	return mapped_argument<R>(n, v, make_mapped_table<R>(std::forward<Ps>(ps)...));
+}
+
 template <typename R, typename F>
 functor_argument<R, typename std::decay<F>::type>
 make_functor_arg(const std::string &n, R &v, F &&f, bool app = false) {
@@ -195,28 +228,32 @@ functor_argument<R, value_convertor> make_number_arg(const std::string &n, R &v)
 }
 
 inline mapped_argument<bool> make_bool_arg(const std::string &n, bool &v) {
-	return make_mapped_arg(n, v,
+	static const auto m = make_mapped_table<bool>(
 			"enable", true, "disable", false,
 			"true", true, "false", false,
 			"on", true, "off", false,
 			"1", true, "0", false);
+	return make_mapped_arg(n, v, m);
 }
 
-
 class configure_manager {
 private:
 	typedef std::reference_wrapper<base_argument> ref_type;
 
 	std::vector<ref_type> _args;
-	hash_map<std::string, ref_type> _dict;
+	perfect_map<std::string, ref_type> _dict;
 
-public:
-	configure_manager(std::initializer_list<ref_type> ls): _args(ls) {
+	static perfect_map<std::string, ref_type> make_dict(std::initializer_list<ref_type> ls) {
+		std::vector<std::pair<std::string, ref_type>> d;
 		for (ref_type r : ls) {
-			_dict.insert({r.get().name(), r});
+			d.emplace_back(r.get().name(), r);
 		}
+		return perfect_map<std::string, ref_type>(std::move(d));
 	}
 
+public:
+	configure_manager(std::initializer_list<ref_type> ls): _args(ls), _dict(make_dict(ls)) {}
+
 	void append(const std::string &k, std::string v) {
 		auto f = _dict.find(k);
 		if ( f == _dict.end() ) {
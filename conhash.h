@@ -0,0 +1,213 @@
+
+
+#ifndef __SEAL_CONHASH_H__
+#define __SEAL_CONHASH_H__
+
+#include "flathash.h"
+#include "macro.h"
+#include "threads.h"
+
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cstdlib>
+
+
+namespace sea {
+
+// A flat_hash_map split into shards, each behind its own spin_lock, so
+// threads touching different keys rarely wait on each other. Values are
+// copied out rather than referenced, since another thread may erase or move
+// them as soon as the shard is unlocked. Whole-map operations take every
+// shard lock in order and so see one consistent state.
+template <typename K, typename V, typename H = sea::hash<K>,
+		 typename P = std::equal_to<K>, typename A = std::allocator<std::pair<const K, V>>>
+class concurrent_hash_map {
+public:
+	typedef K key_type;
+	typedef V mapped_type;
+	typedef std::pair<const K, V> value_type;
+	typedef flat_hash_map<K, V, H, P, A> map_type;
+
+private:
+	struct shard_body {
+		mutable spin_lock lock;
+		map_type map;
+	};
+
+	// padded rather than aligned, new of over-aligned types is C++17, so
+	// the array is allocated by hand on a 64 byte boundary
+	struct shard : public shard_body {
+		char pad[64 - sizeof(shard_body) % 64];
+	};
+
+	static_assert(sizeof(shard) % 64 == 0, "shards must fill whole cache lines");
+
+	struct shard_deleter {
+		size_t n;
+
+		void operator()(shard *p) const noexcept {
+			for (size_t i = 0; i < n; ++i) {
+				p[i].~shard();
+			}
+			free(p);
+		}
+	};
+
+	std::unique_ptr<shard[], shard_deleter> _shards;
+	size_t _mask;
+	H _hash;
+
+	static shard *make_shards(size_t n) {
+		void *p = nullptr;
+		if ( posix_memalign(&p, 64, n * sizeof(shard)) != 0 ) {
+			throw std::bad_alloc();
+		}
+		shard *s = (shard *)p;
+		size_t i = 0;
+		try {
+			for (; i < n; ++i) {
+				new (s + i) shard();
+			}
+		} catch ( ... ) {
+			shard_deleter{i}(s);
+			throw;
+		}
+		return s;
+	}
+
+	shard &shard_of(const key_type &k) const {
+		return _shards[(hash_impl::hash_word(_hash(k)) >> 40) & _mask];
+	}
+
+	class lock_all {
+	private:
+		const concurrent_hash_map &_m;
+
+	public:
+		lock_all(const concurrent_hash_map &m): _m(m) {
+			for (size_t i = 0; i <= _m._mask; ++i) {
+				_m._shards[i].lock.lock();
+			}
+		}
+		~lock_all() noexcept {
+			for (size_t i = 0; i <= _m._mask; ++i) {
+				_m._shards[i].lock.unlock();
+			}
+		}
+	};
+
+public:
+	// by default four shards per hardware thread
+	explicit concurrent_hash_map(size_t n = 0, const H &h = H()): _hash(h) {
+		if ( n == 0 ) {
+			n = std::max(std::thread::hardware_concurrency(), 1u) * 4;
+		}
+		size_t s = 1;
+		while ( s < n ) s <<= 1;
+		_shards = std::unique_ptr<shard[], shard_deleter>(make_shards(s), shard_deleter{s});
+		_mask = s - 1;
+	}
+
+	size_t shards() const { return _mask + 1; }
+
+	bool find(const key_type &k, mapped_type &v) const {
+		shard &s = shard_of(k);
+		std::lock_guard<spin_lock> g(s.lock);
+		auto f = s.map.find(k);
+		if ( f == s.map.end() ) {
+			return false;
+		}
+		v = f->second;
+		return true;
+	}
+
+	bool contains(const key_type &k) const {
+		shard &s = shard_of(k);
+		std::lock_guard<spin_lock> g(s.lock);
+		return s.map.count(k) > 0;
+	}
+
+	// calls f(V &) under the shard lock if k is there, f must not touch the map
+	template <typename F>
+	bool visit(const key_type &k, F &&f) {
+		shard &s = shard_of(k);
+		std::lock_guard<spin_lock> g(s.lock);
+		auto i = s.map.find(k);
+		if ( i == s.map.end() ) {
+			return false;
+		}
+		f(i->second);
+		return true;
+	}
+
+	// inserts only if k is absent, returns whether it did
+	template <typename M>
+	bool insert(const key_type &k, M &&v) {
+		shard &s = shard_of(k);
+		std::lock_guard<spin_lock> g(s.lock);
+		return s.map.try_emplace(k, std::forward<M>(v)).second;
+	}
+
+	// returns true if k was inserted, false if its value was replaced
+	template <typename M>
+	bool insert_or_assign(const key_type &k, M &&v) {
+		shard &s = shard_of(k);
+		std::lock_guard<spin_lock> g(s.lock);
+		return s.map.insert_or_assign(k, std::forward<M>(v)).second;
+	}
+
+	bool erase(const key_type &k) {
+		shard &s = shard_of(k);
+		std::lock_guard<spin_lock> g(s.lock);
+		return s.map.erase(k) > 0;
+	}
+
+	size_t size() const {
+		lock_all g(*this);
+		size_t n = 0;
+		for (size_t i = 0; i <= _mask; ++i) {
+			n += _shards[i].map.size();
+		}
+		return n;
+	}
+
+	bool empty() const { return size() == 0; }
+
+	void clear() {
+		lock_all g(*this);
+		for (size_t i = 0; i <= _mask; ++i) {
+			_shards[i].map.clear();
+		}
+	}
+
+	// f(const K &, const V &) over one consistent state, writers wait meanwhile
+	template <typename F>
+	void for_each(F &&f) const {
+		lock_all g(*this);
+		for (size_t i = 0; i <= _mask; ++i) {
+			for (const value_type &v : _shards[i].map) {
+				f(v.first, v.second);
+			}
+		}
+	}
+
+	std::vector<std::pair<K, V>> snapshot() const {
+		std::vector<std::pair<K, V>> r;
+		lock_all g(*this);
+		for (size_t i = 0; i <= _mask; ++i) {
+			r.insert(r.end(), _shards[i].map.begin(), _shards[i].map.end());
+		}
+		return r;
+	}
+
+	seal_macro_non_copy(concurrent_hash_map)
+};
+
+}
+
+#endif // __SEAL_CONHASH_H__
@@ -2,6 +2,7 @@
 #ifndef __SEAL_ERROR_H__
 #define __SEAL_ERROR_H__
 
+#include "conhash.h"
 #include "threads.h"
 #include "typetraits.h"
 #include "writer.h"
@@ -9,7 +10,6 @@
 #include <stdexcept>
 #include <typeindex>
 #include <exception>
-#include <unordered_map>
 #include <utility>
 
 
@@ -38,7 +38,7 @@ public:
 	typedef std::function<bool (std::exception &)> error_handler;
 
 private:
-	std::unordered_map<std::type_index, error_handler> _map;
+	concurrent_hash_map<std::type_index, error_handler> _map;
 	file_writer _log;
 	spin_lock _lock;
 
@@ -68,19 +68,19 @@ public:
 
 	file_writer &default_logger() { return _log; }
 
+	// setters are serialized by _lock, handle_error only takes a shard lock
 	template <typename E>
 	error_handler set_error_handler(error_handler h) {
 		std::type_index k = typeid(E);
 		std::lock_guard<spin_lock> g(_lock);
-		auto i = _map.find(k);
-		if ( i == _map.end() ) {
-			if ( h ) _map.emplace(k, std::move(h));
-			return error_handler();
+		error_handler o;
+		_map.find(k, o);
+		if ( h ) {
+			_map.insert_or_assign(k, std::move(h));
 		} else {
-			std::swap(i->second, h);
-			if ( !i->second ) _map.erase(i);
-			return std::move(h);
+			_map.erase(k);
 		}
+		return o;
 	}
 
 	template <typename E, typename F, typename is_return<void, F (E &)>::enable = 0>
@@ -106,12 +106,7 @@ public:
 	template <typename E>
 	bool handle_error(E &e) {
 		error_handler h;
-		{
-			std::lock_guard<spin_lock> g(_lock);
-			auto f = _map.find(typeid(E));
-			if ( f == _map.end() ) return false;
-			h = f->second;
-		}
+		if ( !_map.find(typeid(E), h) ) return false;
 		return h(e);
 	}
 
@@ -3,7 +3,7 @@
 #define __SEAL_FILEPOOL_H__
 
 #include "error.h"
-#include "hash.h"
+#include "flathash.h"
 #include "macro.h"
 #include "path.h"
 #include "threads.h"
@@ -33,7 +33,7 @@ private:
 		FILE *file;
 		int rc;
 	};
-	sea::hash_map<size_t, opened> _opened;
+	sea::flat_hash_map<size_t, opened> _opened;
 
 	spin_lock _lock;
 
@@ -0,0 +1,620 @@
+
+
+#ifndef __SEAL_FLATHASH_H__
+#define __SEAL_FLATHASH_H__
+
+#include "hash.h"
+#include "macro.h"
+
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+#include <cstdint>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+namespace sea {
+
+namespace flat_impl {
+
+// One control byte per slot: the low 7 bits of the hash when the slot is
+// full, otherwise one of the negative markers below. A sentinel ends the
+// slots and the first GROUP - 1 bytes are cloned after it, so a group can be
+// loaded at any slot without wrapping.
+typedef int8_t ctrl_t;
+
+static constexpr ctrl_t EMPTY = -128;
+static constexpr ctrl_t DELETED = -2;
+static constexpr ctrl_t SENTINEL = -1;
+static constexpr size_t GROUP = 16;
+
+inline ctrl_t *empty_group() {
+	alignas(16) static ctrl_t g[GROUP] = {
+		SENTINEL, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY,
+		EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY
+	};
+	return g;
+}
+
+// bit i of a mask stands for the i-th byte of the group
+struct group {
+#ifdef __SSE2__
+	__m128i c;
+
+	explicit group(const ctrl_t *p): c(_mm_loadu_si128((const __m128i *)p)) {}
+
+	uint32_t match(ctrl_t h) const {
+		return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h), c));
+	}
+
+	uint32_t match_empty() const { return match(EMPTY); }
+
+	uint32_t match_free() const {
+		return (uint32_t)_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(SENTINEL), c));
+	}
+#else
+	ctrl_t c[GROUP];
+
+	explicit group(const ctrl_t *p) { memcpy(c, p, GROUP); }
+
+	uint32_t match(ctrl_t h) const {
+		uint32_t m = 0;
+		for (size_t i = 0; i < GROUP; ++i) {
+			m |= (uint32_t)(c[i] == h) << i;
+		}
+		return m;
+	}
+
+	uint32_t match_empty() const { return match(EMPTY); }
+
+	uint32_t match_free() const {
+		uint32_t m = 0;
+		for (size_t i = 0; i < GROUP; ++i) {
+			m |= (uint32_t)(c[i] < SENTINEL) << i;
+		}
+		return m;
+	}
+#endif
+};
+
+struct get_self {
+	template <typename T>
+	const T &operator()(const T &v) const { return v; }
+
+	template <typename Al, typename T>
+	static void relocate(Al &a, T *d, T *s) {
+		std::allocator_traits<Al>::construct(a, d, std::move(*s));
+	}
+};
+
+struct get_key {
+	template <typename T>
+	const typename T::first_type &operator()(const T &v) const { return v.first; }
+
+	// the key of a slot is a const object, so moving out of it would be
+	// undefined; it is copied, and only the value is moved
+	template <typename Al, typename T>
+	static void relocate(Al &a, T *d, T *s) {
+		std::allocator_traits<Al>::construct(a, d, std::piecewise_construct,
+				std::forward_as_tuple(s->first), std::forward_as_tuple(std::move(s->second)));
+	}
+};
+
+
+// Open addressing in the SwissTable layout: slots are probed a group of 16
+// control bytes at a time, so a lookup mostly costs one SIMD compare and one
+// key compare, and elements live in a flat array instead of nodes. The
+// table remixes what H returns, so weak hashes such as the identity are fine.
+// Unlike std::unordered_map, pointers and iterators are invalidated by any
+// insertion that grows the table, and map keys must be copy constructible,
+// as growing copies them.
+template <typename T, typename K, typename G, typename H, typename P, typename A>
+class flat_table {
+public:
+	typedef K key_type;
+	typedef T value_type;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+	typedef H hasher;
+	typedef P key_equal;
+	typedef A allocator_type;
+
+private:
+	typedef std::allocator_traits<A> traits;
+	typedef typename traits::template rebind_alloc<T> slot_alloc;
+	typedef std::allocator_traits<slot_alloc> slot_traits;
+	typedef typename traits::template rebind_alloc<ctrl_t> ctrl_alloc;
+	typedef std::allocator_traits<ctrl_alloc> ctrl_traits;
+
+	ctrl_t *_ctrl = empty_group();
+	T *_slots = nullptr;
+	size_t _cap = 0;
+	size_t _size = 0;
+	size_t _growth = 0;
+	H _hash;
+	P _equal;
+	slot_alloc _alloc;
+
+public:
+	template <bool C>
+	class basic_iterator {
+	private:
+		friend class flat_table;
+		template <bool> friend class basic_iterator;
+
+		const ctrl_t *_c = nullptr;
+		T *_s = nullptr;
+
+		basic_iterator(const ctrl_t *c, T *s): _c(c), _s(s) {}
+
+		void skip() {
+			while ( *_c < SENTINEL ) {
+				++_c;
+				++_s;
+			}
+		}
+
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef typename flat_table::value_type value_type;
+		typedef ptrdiff_t difference_type;
+		typedef typename std::conditional<C || std::is_same<K, T>::value, const T, T>::type &reference;
+		typedef typename std::remove_reference<reference>::type *pointer;
+
+		basic_iterator() = default;
+
+		template <bool D, typename std::enable_if<C && !D, int>::type = 0>
+		basic_iterator(const basic_iterator<D> &i): _c(i._c), _s(i._s) {}
+
+		reference operator*() const { return *_s; }
+		pointer operator->() const { return _s; }
+
+		basic_iterator &operator++() {
+			++_c;
+			++_s;
+			skip();
+			return *this;
+		}
+
+		basic_iterator operator++(int) {
+			basic_iterator i = *this;
+			++*this;
+			return i;
+		}
+
+		bool operator==(const basic_iterator &i) const { return _c == i._c; }
+		bool operator!=(const basic_iterator &i) const { return _c != i._c; }
+	};
+
+	typedef basic_iterator<false> iterator;
+	typedef basic_iterator<true> const_iterator;
+
+	flat_table() = default;
+
+	explicit flat_table(size_t n, const H &h = H(), const P &p = P(), const A &a = A()):
+		_hash(h), _equal(p), _alloc(a) { reserve(n); }
+
+	template <typename I>
+	flat_table(I b, I e, size_t n = 0, const H &h = H(), const P &p = P(), const A &a = A()):
+		flat_table(n, h, p, a) { insert(b, e); }
+
+	flat_table(std::initializer_list<T> ls, size_t n = 0, const H &h = H(), const P &p = P(), const A &a = A()):
+		flat_table(ls.begin(), ls.end(), n, h, p, a) {}
+
+	flat_table(const flat_table &t):
+		_hash(t._hash), _equal(t._equal),
+		_alloc(slot_traits::select_on_container_copy_construction(t._alloc)) {
+		reserve(t._size);
+		insert(t.begin(), t.end());
+	}
+
+	flat_table(flat_table &&t) noexcept:
+		_ctrl(t._ctrl), _slots(t._slots), _cap(t._cap), _size(t._size), _growth(t._growth),
+		_hash(std::move(t._hash)), _equal(std::move(t._equal)), _alloc(std::move(t._alloc)) {
+		t.reset();
+	}
+
+	~flat_table() noexcept { destroy(); }
+
+	flat_table &operator=(const flat_table &t) {
+		if ( this != &t ) {
+			flat_table c(t);
+			swap(c);
+		}
+		return *this;
+	}
+
+	flat_table &operator=(flat_table &&t) noexcept {
+		if ( this != &t ) {
+			destroy();
+			_ctrl = t._ctrl;
+			_slots = t._slots;
+			_cap = t._cap;
+			_size = t._size;
+			_growth = t._growth;
+			_hash = std::move(t._hash);
+			_equal = std::move(t._equal);
+			_alloc = std::move(t._alloc);
+			t.reset();
+		}
+		return *this;
+	}
+
+	void swap(flat_table &t) noexcept {
+		using std::swap;
+		swap(_ctrl, t._ctrl);
+		swap(_slots, t._slots);
+		swap(_cap, t._cap);
+		swap(_size, t._size);
+		swap(_growth, t._growth);
+		swap(_hash, t._hash);
+		swap(_equal, t._equal);
+		swap(_alloc, t._alloc);
+	}
+
+	iterator begin() { return make_iter<false>(0); }
+	iterator end() { return {_ctrl + _cap, _slots + _cap}; }
+	const_iterator begin() const { return make_iter<true>(0); }
+	const_iterator end() const { return {_ctrl + _cap, _slots + _cap}; }
+	const_iterator cbegin() const { return begin(); }
+	const_iterator cend() const { return end(); }
+
+	bool empty() const { return _size == 0; }
+	size_t size() const { return _size; }
+	size_t max_size() const { return slot_traits::max_size(_alloc); }
+	size_t bucket_count() const { return _cap; }
+	float load_factor() const { return _cap ? (float)_size / _cap : 0.0f; }
+	float max_load_factor() const { return 7.0f / 8; }
+
+	hasher hash_function() const { return _hash; }
+	key_equal key_eq() const { return _equal; }
+	allocator_type get_allocator() const { return allocator_type(_alloc); }
+
+	iterator find(const key_type &k) {
+		size_t i = find_index(k);
+		return i == _cap ? end() : iterator(_ctrl + i, _slots + i);
+	}
+
+	const_iterator find(const key_type &k) const {
+		size_t i = find_index(k);
+		return i == _cap ? end() : const_iterator(_ctrl + i, _slots + i);
+	}
+
+	size_t count(const key_type &k) const { return find_index(k) != _cap; }
+
+	std::pair<iterator, bool> insert(const value_type &v) {
+		return emplace_key(G()(v), v);
+	}
+
+	std::pair<iterator, bool> insert(value_type &&v) {
+		return emplace_key(G()(v), std::move(v));
+	}
+
+	template <typename I>
+	void insert(I b, I e) {
+		for (; b != e; ++b) {
+			insert(*b);
+		}
+	}
+
+	void insert(std::initializer_list<value_type> ls) { insert(ls.begin(), ls.end()); }
+
+	template <typename ... Args>
+	std::pair<iterator, bool> emplace(Args &&... args) {
+		value_type v(std::forward<Args>(args)...);
+		return insert(std::move(v));
+	}
+
+	iterator erase(const_iterator p) {
+		size_t i = p._c - _ctrl;
+		erase_index(i);
+		iterator n(_ctrl + i, _slots + i);
+		n.skip();
+		return n;
+	}
+
+	iterator erase(iterator p) { return erase(const_iterator(p)); }
+
+	iterator erase(const_iterator b, const_iterator e) {
+		while ( b != e ) {
+			b = erase(b);
+		}
+		return iterator(_ctrl + (e._c - _ctrl), _slots + (e._c - _ctrl));
+	}
+
+	size_t erase(const key_type &k) {
+		size_t i = find_index(k);
+		if ( i == _cap ) {
+			return 0;
+		}
+		erase_index(i);
+		return 1;
+	}
+
+	void clear() {
+		if ( _cap == 0 ) {
+			return;
+		}
+		destroy_slots();
+		reset_ctrl();
+		_size = 0;
+		_growth = max_load(_cap);
+	}
+
+	void reserve(size_t n) {
+		if ( n > _size + _growth ) {
+			resize(capacity_for(n));
+		}
+	}
+
+	void rehash(size_t n) {
+		size_t c = capacity_for(std::max(n, _size));
+		if ( c != _cap || n == 0 ) {
+			resize(c);
+		}
+	}
+
+protected:
+	// finds k or claims a slot for it, the caller constructs the new element
+	std::pair<size_t, bool> prepare_insert(const key_type &k) {
+		size_t h = hash_of(k);
+		size_t i = find_index(k, h);
+		if ( i != _cap ) {
+			return {i, false};
+		}
+		i = find_free(h);
+		if ( unlikely(_growth == 0 && _ctrl[i] != DELETED) ) {
+			resize(_cap > GROUP && _size * 32 <= _cap * 25 ? _cap : std::max(_cap * 2 + 1, GROUP - 1));
+			i = find_free(h);
+		}
+		_growth -= _ctrl[i] == EMPTY;
+		set_ctrl(i, (ctrl_t)(h & 0x7f));
+		++_size;
+		return {i, true};
+	}
+
+	template <typename ... Args>
+	void construct(size_t i, Args &&... args) {
+		try {
+			slot_traits::construct(_alloc, _slots + i, std::forward<Args>(args)...);
+		} catch ( ... ) {
+			set_ctrl(i, DELETED);
+			--_size;
+			throw;
+		}
+	}
+
+	template <typename ... Args>
+	std::pair<iterator, bool> emplace_key(const key_type &k, Args &&... args) {
+		auto r = prepare_insert(k);
+		if ( r.second ) {
+			construct(r.first, std::forward<Args>(args)...);
+		}
+		return {iterator(_ctrl + r.first, _slots + r.first), r.second};
+	}
+
+	iterator iter_at(size_t i) { return iterator(_ctrl + i, _slots + i); }
+
+	size_t find_index(const key_type &k) const { return find_index(k, hash_of(k)); }
+
+private:
+	size_t hash_of(const key_type &k) const {
+		uint64_t x = (uint64_t)_hash(k) * 0x9e3779b97f4a7c15ull;
+		return (size_t)(x ^ (x >> 32));
+	}
+
+	static size_t max_load(size_t c) { return c - c / 8; }
+
+	static size_t capacity_for(size_t n) {
+		size_t c = GROUP - 1;
+		while ( max_load(c) < n ) {
+			c = c * 2 + 1;
+		}
+		return c;
+	}
+
+	size_t find_index(const key_type &k, size_t h) const {
+		size_t p = (h >> 7) & _cap;
+		ctrl_t h2 = (ctrl_t)(h & 0x7f);
+		for (size_t s = GROUP; ; s += GROUP) {
+			group g(_ctrl + p);
+			for (uint32_t m = g.match(h2); m; m &= m - 1) {
+				size_t i = (p + __builtin_ctz(m)) & _cap;
+				if ( likely(_equal(G()(_slots[i]), k)) ) {
+					return i;
+				}
+			}
+			if ( g.match_empty() ) {
+				return _cap;
+			}
+			p = (p + s) & _cap;
+		}
+	}
+
+	size_t find_free(size_t h) const {
+		size_t p = (h >> 7) & _cap;
+		for (size_t s = GROUP; ; s += GROUP) {
+			uint32_t m = group(_ctrl + p).match_free();
+			if ( m ) {
+				return (p + __builtin_ctz(m)) & _cap;
+			}
+			p = (p + s) & _cap;
+		}
+	}
+
+	void set_ctrl(size_t i, ctrl_t c) {
+		_ctrl[i] = c;
+		_ctrl[((i - (GROUP - 1)) & _cap) + (GROUP - 1)] = c;
+	}
+
+	void reset_ctrl() {
+		memset(_ctrl, EMPTY, _cap + GROUP);
+		_ctrl[_cap] = SENTINEL;
+	}
+
+	// a slot may go back to EMPTY only if no probe ever passed it on its way
+	// to a full group, that is if no window of GROUP slots around it is full
+	void erase_index(size_t i) {
+		slot_traits::destroy(_alloc, _slots + i);
+		--_size;
+		uint32_t ea = group(_ctrl + i).match_empty();
+		uint32_t eb = group(_ctrl + ((i - GROUP) & _cap)).match_empty();
+		bool never_full = ea && eb
+			&& (size_t)(__builtin_ctz(ea) + __builtin_clz(eb) - 16) < GROUP;
+		set_ctrl(i, never_full ? EMPTY : DELETED);
+		_growth += never_full;
+	}
+
+	template <bool C>
+	basic_iterator<C> make_iter(size_t i) const {
+		basic_iterator<C> r(_ctrl + i, _slots + i);
+		r.skip();
+		return r;
+	}
+
+	void resize(size_t c) {
+		ctrl_t *oc = _ctrl;
+		T *os = _slots;
+		size_t on = _cap;
+
+		ctrl_alloc ca(_alloc);
+		_ctrl = ctrl_traits::allocate(ca, c + GROUP);
+		try {
+			_slots = slot_traits::allocate(_alloc, c);
+		} catch ( ... ) {
+			ctrl_traits::deallocate(ca, _ctrl, c + GROUP);
+			_ctrl = oc;
+			throw;
+		}
+		_cap = c;
+		reset_ctrl();
+		_growth = max_load(c) - _size;
+
+		for (size_t i = 0; i < on; ++i) {
+			if ( oc[i] >= 0 ) {
+				size_t h = hash_of(G()(os[i]));
+				size_t j = find_free(h);
+				set_ctrl(j, (ctrl_t)(h & 0x7f));
+				relocate(_slots + j, os + i);
+			}
+		}
+		if ( on > 0 ) {
+			ctrl_traits::deallocate(ca, oc, on + GROUP);
+			slot_traits::deallocate(_alloc, os, on);
+		}
+	}
+
+	void relocate(T *d, T *s) {
+		G::relocate(_alloc, d, s);
+		slot_traits::destroy(_alloc, s);
+	}
+
+	void destroy_slots() {
+		for (size_t i = 0; i < _cap; ++i) {
+			if ( _ctrl[i] >= 0 ) {
+				slot_traits::destroy(_alloc, _slots + i);
+			}
+		}
+	}
+
+	void destroy() {
+		if ( _cap > 0 ) {
+			destroy_slots();
+			ctrl_alloc ca(_alloc);
+			ctrl_traits::deallocate(ca, _ctrl, _cap + GROUP);
+			slot_traits::deallocate(_alloc, _slots, _cap);
+		}
+		reset();
+	}
+
+	void reset() {
+		_ctrl = empty_group();
+		_slots = nullptr;
+		_cap = 0;
+		_size = 0;
+		_growth = 0;
+	}
+};
+
+}
+
+
+template <typename T, typename H = sea::hash<T>,
+		 typename P = std::equal_to<T>, typename A = std::allocator<T>>
+class flat_hash_set : public flat_impl::flat_table<T, T, flat_impl::get_self, H, P, A> {
+private:
+	typedef flat_impl::flat_table<T, T, flat_impl::get_self, H, P, A> base_type;
+
+public:
+	using base_type::base_type;
+	flat_hash_set() = default;
+};
+
+
+template <typename K, typename V, typename H = sea::hash<K>,
+		 typename P = std::equal_to<K>, typename A = std::allocator<std::pair<const K, V>>>
+class flat_hash_map : public flat_impl::flat_table<std::pair<const K, V>, K, flat_impl::get_key, H, P, A> {
+private:
+	typedef flat_impl::flat_table<std::pair<const K, V>, K, flat_impl::get_key, H, P, A> base_type;
+
+public:
+	typedef V mapped_type;
+	typedef typename base_type::iterator iterator;
+
+	using base_type::base_type;
+	flat_hash_map() = default;
+
+	template <typename ... Args>
+	std::pair<iterator, bool> try_emplace(const K &k, Args &&... args) {
+		auto r = this->prepare_insert(k);
+		if ( r.second ) {
+			this->construct(r.first, std::piecewise_construct,
+					std::forward_as_tuple(k), std::forward_as_tuple(std::forward<Args>(args)...));
+		}
+		return {this->iter_at(r.first), r.second};
+	}
+
+	template <typename ... Args>
+	std::pair<iterator, bool> try_emplace(K &&k, Args &&... args) {
+		auto r = this->prepare_insert(k);
+		if ( r.second ) {
+			this->construct(r.first, std::piecewise_construct,
+					std::forward_as_tuple(std::move(k)), std::forward_as_tuple(std::forward<Args>(args)...));
+		}
+		return {this->iter_at(r.first), r.second};
+	}
+
+	template <typename M>
+	std::pair<iterator, bool> insert_or_assign(const K &k, M &&m) {
+		auto r = try_emplace(k, std::forward<M>(m));
+		if ( !r.second ) {
+			r.first->second = std::forward<M>(m);
+		}
+		return r;
+	}
+
+	V &operator[](const K &k) { return try_emplace(k).first->second; }
+	V &operator[](K &&k) { return try_emplace(std::move(k)).first->second; }
+
+	V &at(const K &k) {
+		size_t i = this->find_index(k);
+		if ( i == this->bucket_count() ) {
+			throw std::out_of_range("flat_hash_map::at");
+		}
+		return this->iter_at(i)->second;
+	}
+
+	const V &at(const K &k) const { return const_cast<flat_hash_map *>(this)->at(k); }
+};
+
+}
+
+#endif // __SEAL_FLATHASH_H__
@@ -5,13 +5,161 @@
 #include "typetraits.h"
 #include "macro.h"
 
+#include <algorithm>
+#include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+#include <cstring>
 
 
 namespace sea {
 seal_macro_def_has_elem(hash_code);
 
+namespace hash_impl {
+
+static constexpr uint64_t P0 = 0xa0761d6478bd642full;
+static constexpr uint64_t P1 = 0xe7037ed1a0b428dbull;
+static constexpr uint64_t P2 = 0x8ebc6af09c88c6e3ull;
+static constexpr uint64_t P3 = 0x589965cc75374cc3ull;
+
+// a, b = low and high half of a * b
+inline void mum(uint64_t &a, uint64_t &b) {
+#ifdef __SIZEOF_INT128__
+	__extension__ typedef unsigned __int128 uint128;
+	uint128 r = (uint128)a * b;
+	a = (uint64_t)r;
+	b = (uint64_t)(r >> 64);
+#else
+	uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	a = lo;
+	b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+inline uint64_t mix(uint64_t a, uint64_t b) {
+	mum(a, b);
+	return a ^ b;
+}
+
+// a bijection, so distinct words never collide before the table folds them
+inline uint64_t hash_word(uint64_t x) {
+	x ^= x >> 27;
+	x *= 0x3c79ac492ba7b653ull;
+	x ^= x >> 33;
+	x *= 0x1c69b3f74ac4ae35ull;
+	x ^= x >> 27;
+	return x;
+}
+
+inline uint64_t read8(const uint8_t *p) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+inline uint64_t read4(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+// wyhash (Wang Yi, final version 4). The bulk path is scalar, not
+// vectorized: wyhash mixes with 64x64->128 multiplies, which SSE and AVX2
+// lack, and a vector path would have to be a different hash, e.g. XXH3's
+// accumulators. Long inputs go through three independent multiply chains
+// of 16 bytes each, so the chains can overlap in the pipeline.
+inline uint64_t hash_bytes(const void *data, size_t n, uint64_t seed = 0) {
+	const uint8_t *p = (const uint8_t *)data;
+	seed ^= mix(seed ^ P0, P1);
+	uint64_t a, b;
+	if ( likely(n <= 16) ) {
+		if ( n >= 4 ) {
+			size_t m = (n >> 3) << 2;
+			a = (read4(p) << 32) | read4(p + m);
+			b = (read4(p + n - 4) << 32) | read4(p + n - 4 - m);
+		} else if ( n > 0 ) {
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[n >> 1] << 8) | p[n - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t i = n;
+		if ( unlikely(i > 48) ) {
+			uint64_t s1 = seed, s2 = seed;
+			do {
+				seed = mix(read8(p) ^ P1, read8(p + 8) ^ seed);
+				s1 = mix(read8(p + 16) ^ P2, read8(p + 24) ^ s1);
+				s2 = mix(read8(p + 32) ^ P3, read8(p + 40) ^ s2);
+				p += 48;
+				i -= 48;
+			} while ( i > 48 );
+			seed ^= s1 ^ s2;
+		}
+		while ( unlikely(i > 16) ) {
+			seed = mix(read8(p) ^ P1, read8(p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		a = read8(p + i - 16);
+		b = read8(p + i - 8);
+	}
+	a ^= P1;
+	b ^= seed;
+	mum(a, b);
+	return mix(a ^ P0 ^ n, b ^ P1);
+}
+
+template <typename T>
+struct is_word : public std::integral_constant<bool,
+	(std::is_integral<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value)
+	&& sizeof(T) <= sizeof(uint64_t)> {};
+
+template <typename T>
+struct is_string : public std::false_type {};
+
+template <typename C, typename R, typename A>
+struct is_string<std::basic_string<C, R, A>> : public std::true_type {};
+
+template <typename T, typename = void>
+struct has_std_hash : public std::false_type {};
+
+template <typename T>
+struct has_std_hash<T, typename make_void<decltype(std::declval<std::hash<T>>()(std::declval<T>()))>::type>
+	: public std::true_type {};
+
+// what std::hash is still used for, the types above have their own
+template <typename T>
+struct use_std_hash : public std::integral_constant<bool,
+	has_std_hash<T>::value && !is_word<T>::value && !is_string<T>::value> {};
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value, uint64_t>::type
+word_of(T v) { return (uint64_t)v; }
+
+template <typename T>
+typename std::enable_if<std::is_enum<T>::value, uint64_t>::type
+word_of(T v) { return (uint64_t)(typename std::underlying_type<T>::type)v; }
+
+template <typename T>
+uint64_t word_of(T *v) { return (uint64_t)(uintptr_t)v; }
+
+}
+
+
+// Types with a hash_code() member use it, integers, enums and pointers are
+// mixed, strings go through hash_bytes, and everything else std::hash can
+// take is left to it. legacy_hash is the old behaviour, for tables whose
+// order or hash values are relied upon.
 template <typename T, typename = void>
 struct hash {
 	typedef size_t result_type;
@@ -21,8 +169,49 @@ struct hash {
 	};
 };
 
+template <typename T>
+struct hash<T, typename std::enable_if<hash_impl::is_word<T>::value>::type> {
+	typedef size_t result_type;
+	typedef T arg_type;
+	size_t operator()(const arg_type &a) const noexcept {
+		return (size_t)hash_impl::hash_word(hash_impl::word_of(a));
+	}
+};
+
+template <typename C, typename R, typename A>
+struct hash<std::basic_string<C, R, A>> {
+	typedef size_t result_type;
+	typedef std::basic_string<C, R, A> arg_type;
+	size_t operator()(const arg_type &a) const noexcept {
+		return (size_t)hash_impl::hash_bytes(a.data(), a.size() * sizeof(C));
+	}
+};
+
 template <typename T, typename U>
 struct hash<std::pair<T *, U *>> {
+	typedef size_t result_type;
+	typedef std::pair<T *, U *> arg_type;
+	size_t operator()(const arg_type &a) const noexcept {
+		uint64_t v = hash_impl::hash_word((uint64_t)(uintptr_t)a.first);
+		return (size_t)hash_impl::hash_word(v ^ (uint64_t)(uintptr_t)a.second);
+	}
+};
+
+template <typename T>
+struct hash<T, typename std::enable_if<hash_impl::use_std_hash<T>::value>::type> : public std::hash<T> {};
+
+
+template <typename T, typename = void>
+struct legacy_hash {
+	typedef size_t result_type;
+	typedef T arg_type;
+	size_t operator()(const arg_type &a) const noexcept {
+		return a.hash_code();
+	};
+};
+
+template <typename T, typename U>
+struct legacy_hash<std::pair<T *, U *>> {
 	typedef size_t result_type;
 	typedef std::pair<T *, U *> arg_type;
 	size_t operator()(const arg_type &a) const noexcept {
@@ -35,7 +224,7 @@ struct hash<std::pair<T *, U *>> {
 };
 
 template <typename T>
-struct hash<T, typename make_void<decltype(std::declval<std::hash<T>>()(std::declval<T>()))>::type> : public std::hash<T> {};
+struct legacy_hash<T, typename make_void<decltype(std::declval<std::hash<T>>()(std::declval<T>()))>::type> : public std::hash<T> {};
 
 
 template <typename T, typename H = sea::hash<T>,
@@ -43,9 +232,222 @@ template <typename T, typename H = sea::hash<T>,
 using hash_set = std::unordered_set<T, H, P, A>;
 
 template <typename K, typename V, typename H = sea::hash<K>,
-		 typename P = std::equal_to<K>, typename A = std::allocator<std::pair<K, V>>>
+		 typename P = std::equal_to<K>, typename A = std::allocator<std::pair<const K, V>>>
 using hash_map = std::unordered_map<K, V, H, P, A>;
 
+
+// Read-only map over a key set fixed at construction. Hash-and-displace puts
+// every hash value in a slot of its own, so find() hashes once, probes one
+// slot and compares one key. Distinct keys sharing a full hash, which weak
+// user hashes can produce, share a chain searched by compare instead.
+// Iteration follows construction order, and of duplicated keys the first one
+// is kept.
+template <typename K, typename V, typename H = sea::hash<K>, typename P = std::equal_to<K>>
+class perfect_map {
+public:
+	typedef K key_type;
+	typedef V mapped_type;
+	typedef std::pair<K, V> value_type;
+	typedef typename std::vector<value_type>::const_iterator const_iterator;
+	typedef const_iterator iterator;
+
+private:
+	static constexpr uint32_t EMPTY = UINT32_MAX;
+	static constexpr uint32_t CHAIN = (uint32_t)1 << 31;
+	static constexpr uint32_t MAX_DISP = 1 << 16;
+
+	std::vector<value_type> _items;
+	// a slot holds an item index, or CHAIN plus the offset in _chain of a
+	// count followed by that many item indexes
+	std::vector<uint32_t> _disp, _slots, _chain;
+	size_t _bmask = 0;
+	int _shift = 63;
+	H _hash;
+	P _equal;
+
+	size_t slot(size_t h, uint32_t d) const {
+		uint64_t x = ((uint64_t)h ^ (d * 0x9e3779b97f4a7c15ull)) * 0xff51afd7ed558ccdull;
+		return (size_t)((x ^ (x >> 29)) * 0xc4ceb9fe1a85ec53ull >> _shift);
+	}
+
+public:
+	perfect_map() = default;
+
+	template <typename I>
+	perfect_map(I b, I e, const H &h = H(), const P &p = P()): _hash(h), _equal(p) {
+		for (; b != e; ++b) {
+			_items.emplace_back(b->first, b->second);
+		}
+		build();
+	}
+
+	// takes the pairs over without copying them
+	explicit perfect_map(std::vector<value_type> &&items, const H &h = H(), const P &p = P()):
+		_items(std::move(items)), _hash(h), _equal(p) { build(); }
+
+	perfect_map(std::initializer_list<value_type> ls): perfect_map(ls.begin(), ls.end()) {}
+
+	template <typename C>
+	explicit perfect_map(const C &c): perfect_map(c.begin(), c.end()) {}
+
+	const_iterator find(const key_type &k) const {
+		if ( _slots.empty() ) {
+			return end();
+		}
+		size_t h = _hash(k);
+		uint32_t i = _slots[slot(h, _disp[h & _bmask])];
+		if ( likely(i < CHAIN) ) {
+			return _equal(_items[i].first, k) ? begin() + i : end();
+		} else if ( i == EMPTY ) {
+			return end();
+		}
+		const uint32_t *c = _chain.data() + (i - CHAIN);
+		for (uint32_t j = 1; j <= c[0]; ++j) {
+			if ( _equal(_items[c[j]].first, k) ) {
+				return begin() + c[j];
+			}
+		}
+		return end();
+	}
+
+	size_t count(const key_type &k) const { return find(k) != end(); }
+
+	const_iterator begin() const { return _items.begin(); }
+	const_iterator end() const { return _items.end(); }
+	const_iterator cbegin() const { return _items.cbegin(); }
+	const_iterator cend() const { return _items.cend(); }
+	size_t size() const { return _items.size(); }
+	bool empty() const { return _items.empty(); }
+
+private:
+	void build() {
+		size_t n = _items.size();
+		std::vector<size_t> hs(n);
+		for (size_t i = 0; i < n; ++i) {
+			hs[i] = _hash(_items[i].first);
+		}
+		dedup(hs);
+		if ( _items.empty() ) {
+			return;
+		}
+
+		// one unit per distinct hash, since equal hashes can never be split
+		std::vector<size_t> uh;
+		std::vector<uint32_t> uv;
+		std::vector<uint32_t> idx = by_hash(hs);
+		for (size_t r = 0, e; r < idx.size(); r = e) {
+			for (e = r + 1; e < idx.size() && hs[idx[e]] == hs[idx[r]]; ++e);
+			uh.push_back(hs[idx[r]]);
+			if ( e - r == 1 ) {
+				uv.push_back(idx[r]);
+				continue;
+			}
+			uv.push_back(CHAIN + (uint32_t)_chain.size());
+			_chain.push_back((uint32_t)(e - r));
+			_chain.insert(_chain.end(), idx.begin() + r, idx.begin() + e);
+		}
+		n = uh.size();
+
+		size_t nb = 1, m = 2;
+		while ( nb < n / 2 ) nb <<= 1;
+		while ( m < n + n / 4 ) m <<= 1;
+		_bmask = nb - 1;
+
+		std::vector<std::vector<uint32_t>> bk(nb);
+		for (size_t i = 0; i < n; ++i) {
+			bk[uh[i] & _bmask].push_back((uint32_t)i);
+		}
+		std::vector<uint32_t> order(nb);
+		for (size_t i = 0; i < nb; ++i) {
+			order[i] = (uint32_t)i;
+		}
+		std::stable_sort(order.begin(), order.end(),
+				[&bk] (uint32_t a, uint32_t b) { return bk[a].size() > bk[b].size(); });
+
+		while ( !place(uh, uv, bk, order, m) ) {
+			m <<= 1;
+		}
+	}
+
+	// item indexes ordered by hash, then by construction order
+	static std::vector<uint32_t> by_hash(const std::vector<size_t> &hs) {
+		std::vector<uint32_t> idx(hs.size());
+		for (size_t i = 0; i < idx.size(); ++i) {
+			idx[i] = (uint32_t)i;
+		}
+		std::sort(idx.begin(), idx.end(), [&hs] (uint32_t a, uint32_t b) {
+				return hs[a] != hs[b] ? hs[a] < hs[b] : a < b;
+			});
+		return idx;
+	}
+
+	// drops repeated keys, comparing each key only with the earlier ones of its hash
+	void dedup(std::vector<size_t> &hs) {
+		std::vector<uint32_t> idx = by_hash(hs);
+		std::vector<bool> drop(hs.size());
+		for (size_t r = 0, e = 1; e < idx.size(); ++e) {
+			if ( hs[idx[e]] != hs[idx[r]] ) {
+				r = e;
+				continue;
+			}
+			for (size_t j = r; j < e; ++j) {
+				if ( !drop[idx[j]] && _equal(_items[idx[j]].first, _items[idx[e]].first) ) {
+					drop[idx[e]] = true;
+					break;
+				}
+			}
+		}
+		size_t j = 0;
+		for (size_t i = 0; i < drop.size(); ++i) {
+			if ( !drop[i] ) {
+				if ( i != j ) {
+					_items[j] = std::move(_items[i]);
+					hs[j] = hs[i];
+				}
+				++j;
+			}
+		}
+		_items.erase(_items.begin() + j, _items.end());
+		hs.resize(j);
+	}
+
+	bool place(const std::vector<size_t> &uh, const std::vector<uint32_t> &uv,
+			const std::vector<std::vector<uint32_t>> &bk, const std::vector<uint32_t> &order, size_t m) {
+		_shift = 64 - __builtin_ctzll(m);
+		_slots.assign(m, (uint32_t)EMPTY);
+		_disp.assign(bk.size(), 0);
+		std::vector<size_t> taken;
+		for (uint32_t b : order) {
+			const std::vector<uint32_t> &ks = bk[b];
+			if ( ks.empty() ) {
+				break;
+			}
+			uint32_t d = 0;
+			for (; d < MAX_DISP; ++d) {
+				taken.clear();
+				for (uint32_t k : ks) {
+					size_t s = slot(uh[k], d);
+					if ( _slots[s] != EMPTY || std::find(taken.begin(), taken.end(), s) != taken.end() ) {
+						break;
+					}
+					taken.push_back(s);
+				}
+				if ( taken.size() == ks.size() ) {
+					break;
+				}
+			}
+			if ( d == MAX_DISP ) {
+				return false;
+			}
+			_disp[b] = d;
+			for (size_t i = 0; i < ks.size(); ++i) {
+				_slots[taken[i]] = uv[ks[i]];
+			}
+		}
+		return true;
+	}
+};
+
 }
 
 #endif
@@ -0,0 +1,130 @@
+#ifndef __SEAL_MMAPWRITER_H__
+#define __SEAL_MMAPWRITER_H__
+
+#include "macro.h"
+#include "writer.h"
+
+#include <algorithm>
+#include <string>
+
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+namespace sea {
+
+// Writes straight into a shared mapping of the file, which is preallocated
+// and grown geometrically as needed, and cut to the written size on close.
+// The blocks are reserved before they are mapped, so a full disk fails the
+// grow instead of raising SIGBUS on a later store; what does not fit is
+// dropped and error() tells why. Uses mremap(), so Linux only.
+class mmap_writer : public writer {
+private:
+	int _fd;
+	char *_map = nullptr;
+	size_t _len = 0, _cap = 0;
+	int _err = 0;
+
+public:
+	static constexpr size_t DEFAULT_SIZE = 1 << 20;
+
+	mmap_writer(const char *path, size_t n = DEFAULT_SIZE):
+		_fd(::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) {
+		if ( _fd < 0 ) {
+			fail(errno);
+		} else {
+			grow(n);
+		}
+	}
+	mmap_writer(const std::string &path, size_t n = DEFAULT_SIZE): mmap_writer(path.data(), n) {}
+	~mmap_writer() noexcept { close(); }
+	using writer::write;
+	writer &write(char c) override {
+		if ( likely(_len < _cap) || grow(1) ) {
+			_map[_len++] = c;
+		}
+		return *this;
+	}
+	writer &write(const void *p, size_t n) override {
+		if ( likely(n <= _cap - _len) || grow(n) ) {
+			memcpy(_map + _len, p, n);
+			_len += n;
+		}
+		return *this;
+	}
+	writer &vformat(const char *f, va_list p) override {
+		va_list q;
+		va_copy(q, p);
+		int n = vsnprintf(_map + _len, _cap - _len, f, q);
+		va_end(q);
+		if ( n < 0 ) {
+		} else if ( (size_t)n < _cap - _len ) {
+			_len += n;
+		} else if ( grow(n + 1) ) {
+			_len += vsnprintf(_map + _len, _cap - _len, f, p);
+		}
+		return *this;
+	}
+	writer &flush() override { return *this; }
+
+	bool is_open() const { return _map != nullptr; }
+	size_t size() const { return _len; }
+	// errno of the first call that failed, 0 if none did
+	int error() const { return _err; }
+
+	// returns false if anything failed since the file was opened
+	bool close() {
+		if ( _fd < 0 ) return _err == 0;
+		if ( _map != nullptr ) {
+			if ( munmap(_map, _cap) != 0 ) fail(errno);
+			_map = nullptr;
+		}
+		if ( ftruncate(_fd, _len) != 0 ) fail(errno);
+		if ( ::close(_fd) != 0 ) fail(errno);
+		_fd = -1;
+		_cap = _len = 0;
+		return _err == 0;
+	}
+
+	seal_macro_non_copy(mmap_writer)
+
+private:
+	void fail(int e) {
+		if ( _err == 0 ) _err = e;
+	}
+
+	bool grow(size_t n) {
+		if ( _fd < 0 ) return false;
+		static const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+		// at least a page, posix_fallocate() takes no empty range
+		size_t c = std::max(std::max(_cap * 2, _len + n), page);
+		c = (c + page - 1) / page * page;
+		// unlike ftruncate, this allocates the blocks, emulating fallocate
+		// where the file system lacks it
+		int e = posix_fallocate(_fd, _cap, c - _cap);
+		if ( e != 0 ) {
+			fail(e);
+			return false;
+		}
+		void *m = _map == nullptr
+			? mmap(nullptr, c, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0)
+			: mremap(_map, _cap, c, MREMAP_MAYMOVE);
+		if ( m == MAP_FAILED ) {
+			fail(errno);
+			return false;
+		}
+		_map = (char *)m;
+		_cap = c;
+		return true;
+	}
+};
+
+}
+
+#endif // __SEAL_MMAPWRITER_H__
@@ -2,11 +2,29 @@
 #ifndef __SEAL_SPLIT_H__
 #define __SEAL_SPLIT_H__
 
+#include "charconv.h"
 #include "iters.h"
+#include "macro.h"
+#include "threads.h"
 
 #include <algorithm>
+#include <memory>
 #include <string>
+#include <tuple>
 #include <unordered_map>
+#include <vector>
+
+#include <cassert>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 
 namespace sea {
@@ -14,39 +32,141 @@ namespace sea {
 class char_mask {
 private:
 	uint64_t _arr[4];
+	// _nib[l] has bit h set if (h << 4 | l) is in the set, for h < 8, and
+	// _nib[16 + l] the same for h - 8, the layout used by the vector scans
+	uint8_t _nib[32];
 
 	static constexpr uint64_t trans(const char *s, size_t o) {
-		return *s ? (set((size_t)*s, o) | trans(s+1, o)) : 0;
+		return *s ? (set((unsigned char)*s, o) | trans(s+1, o)) : 0;
 	}
 
 	static constexpr uint64_t set(size_t i, size_t o) {
 		return i / 64 == o ? ((uint64_t)1 << i % 64) : 0;
 	}
 
-	constexpr char_mask(uint64_t a, uint64_t b, uint64_t c, uint64_t d): _arr{a, b, c, d} {}
+	static constexpr bool test(uint64_t a, uint64_t b, uint64_t c, uint64_t d, size_t i) {
+		return ((i < 64 ? a : i < 128 ? b : i < 192 ? c : d) >> i % 64) & 1;
+	}
+
+	static constexpr uint8_t nib(uint64_t a, uint64_t b, uint64_t c, uint64_t d, size_t i, size_t h = 0) {
+		return h == 8 ? 0 : (uint8_t)(test(a, b, c, d, ((i / 16 * 8 + h) << 4) | i % 16) << h | nib(a, b, c, d, i, h + 1));
+	}
+
+	template <size_t ... Is>
+	constexpr char_mask(uint64_t a, uint64_t b, uint64_t c, uint64_t d, index_sequence<Is...>):
+		_arr{a, b, c, d}, _nib{nib(a, b, c, d, Is)...} {}
 
 public:
 	static constexpr char_mask make(const char *s) {
-		return char_mask(trans(s, 0), trans(s, 1), trans(s, 2), trans(s, 3));
+		return char_mask(trans(s, 0), trans(s, 1), trans(s, 2), trans(s, 3), make_index_sequence<32>());
 	}
 
-	char_mask(const char *s): _arr{} {
+	char_mask(const char *s): _arr{}, _nib{} {
 		while ( *s ) set(*s++, true);
 	}
 
 	constexpr bool operator[](char c) const { return test(c); }
 	constexpr bool operator()(char c) const { return test(c); }
-	constexpr bool test(char c) const { return test((size_t)c); }
+	constexpr bool test(char c) const { return test((size_t)(unsigned char)c); }
 	constexpr bool test(size_t i) const { return _arr[i / 64] & ((uint64_t)1 << i % 64); }
 
-	char_mask &set(char c, bool v) { return set((size_t)c, v); }
+	char_mask &set(char c, bool v) { return set((size_t)(unsigned char)c, v); }
 	char_mask &set(size_t i, bool v) {
-		if ( v ) _arr[i / 64] |= ((uint64_t)1 << i % 64);
-		else _arr[i / 64] &= ~((uint64_t)1 << i % 64);
+		uint8_t &n = _nib[i >> 7 << 4 | (i & 15)];
+		if ( v ) {
+			_arr[i / 64] |= ((uint64_t)1 << i % 64);
+			n |= (uint8_t)(1 << (i >> 4 & 7));
+		} else {
+			_arr[i / 64] &= ~((uint64_t)1 << i % 64);
+			n &= (uint8_t)~(1 << (i >> 4 & 7));
+		}
 		return *this;
 	}
 
-	void clear() { _arr[0] = _arr[1] = _arr[2] = _arr[3] = 0; }
+	void clear() {
+		_arr[0] = _arr[1] = _arr[2] = _arr[3] = 0;
+		memset(_nib, 0, sizeof(_nib));
+	}
+
+	// first position in [b, e) whose membership is v, or e
+	const char *find(const char *b, const char *e, bool v = true) const {
+		return scanner()(*this, b, e, v);
+	}
+	const char *find_not(const char *b, const char *e) const { return find(b, e, false); }
+
+private:
+	typedef const char *(*scan_func)(const char_mask &, const char *, const char *, bool);
+
+	static const char *scan(const char_mask &m, const char *b, const char *e, bool v) {
+		while ( b != e && m.test(*b) != v ) ++b;
+		return b;
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	__attribute__ ((target("sse4.2")))
+	static const char *scan_sse42(const char_mask &m, const char *b, const char *e, bool v) {
+		const __m128i lt = _mm_loadu_si128((const __m128i *)m._nib);
+		const __m128i ht = _mm_loadu_si128((const __m128i *)(m._nib + 16));
+		const __m128i ls = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+		const __m128i hs = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8, 16, 32, 64, -128);
+		const __m128i nm = _mm_set1_epi8(0x0f);
+		const __m128i zero = _mm_setzero_si128();
+		const unsigned flip = v ? 0xffff : 0;
+		while ( e - b >= 16 ) {
+			__m128i x = _mm_loadu_si128((const __m128i *)b);
+			__m128i lo = _mm_and_si128(x, nm);
+			__m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), nm);
+			__m128i r = _mm_or_si128(
+					_mm_and_si128(_mm_shuffle_epi8(lt, lo), _mm_shuffle_epi8(ls, hi)),
+					_mm_and_si128(_mm_shuffle_epi8(ht, lo), _mm_shuffle_epi8(hs, hi)));
+			unsigned k = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(r, zero)) ^ flip;
+			if ( k != 0 ) return b + __builtin_ctz(k);
+			b += 16;
+		}
+		return scan(m, b, e, v);
+	}
+
+	__attribute__ ((target("avx2")))
+	static const char *scan_avx2(const char_mask &m, const char *b, const char *e, bool v) {
+		const __m256i lt = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)m._nib));
+		const __m256i ht = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(m._nib + 16)));
+		const __m256i ls = _mm256_setr_epi8(
+				1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0,
+				1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+		const __m256i hs = _mm256_setr_epi8(
+				0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8, 16, 32, 64, -128,
+				0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8, 16, 32, 64, -128);
+		const __m256i nm = _mm256_set1_epi8(0x0f);
+		const __m256i zero = _mm256_setzero_si256();
+		const unsigned flip = v ? 0xffffffff : 0;
+		while ( e - b >= 32 ) {
+			__m256i x = _mm256_loadu_si256((const __m256i *)b);
+			__m256i lo = _mm256_and_si256(x, nm);
+			__m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), nm);
+			__m256i r = _mm256_or_si256(
+					_mm256_and_si256(_mm256_shuffle_epi8(lt, lo), _mm256_shuffle_epi8(ls, hi)),
+					_mm256_and_si256(_mm256_shuffle_epi8(ht, lo), _mm256_shuffle_epi8(hs, hi)));
+			unsigned k = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(r, zero)) ^ flip;
+			if ( k != 0 ) return b + __builtin_ctz(k);
+			b += 32;
+		}
+		return scan_sse42(m, b, e, v);
+	}
+
+	static scan_func select() {
+		__builtin_cpu_init();
+		if ( __builtin_cpu_supports("avx2") ) return scan_avx2;
+		if ( __builtin_cpu_supports("sse4.2") ) return scan_sse42;
+		return scan;
+	}
+#else
+	static scan_func select() { return scan; }
+#endif
+
+	static scan_func scanner() {
+		static const scan_func f = select();
+		return f;
+	}
 };
 
 
@@ -54,17 +174,29 @@ class spliter {
 public:
 	typedef std::string::const_iterator str_iter;
 	typedef iter_pair<str_iter> sub_str;
+	typedef iter_pair<const char *> str_view;
 
 private:
 	char_mask _sep;
 
 public:
+	struct column_result {
+		size_t rows = 0;
+		// lines left out for a missing or extra field, or a numeric field
+		// that did not parse whole
+		size_t rejected = 0;
+		// index among the non-blank lines, npos if none was rejected
+		size_t first_rejected = std::string::npos;
+	};
+
 	constexpr spliter(): _sep(char_mask::make(" \t\n\r")) {}
 
 	constexpr spliter(const char_mask &m): _sep(m) {}
 
 	spliter(const char *s): _sep(s) {}
 
+	const char_mask &separators() const { return _sep; }
+
 	template <typename __F>
 	void split(const std::string &str, __F &&f) const {
 		str_iter pos = str.begin();
@@ -82,25 +214,315 @@ public:
 		return std::move(rst);
 	}
 
+	template <typename __F>
+	void split(const char *s, size_t n, __F &&f) const {
+		const char *pos = s, *end = s + n;
+		while ( pos != end ) {
+			str_view v = next_token(pos, end);
+			if ( v.begin() < v.end() ) {
+				f(v);
+			}
+		}
+	}
+
+	// views into s, out is cleared but keeps its capacity across calls
+	size_t split(const char *s, size_t n, std::vector<str_view> &out) const {
+		out.clear();
+		split(s, n, [&out](const str_view &v) { out.push_back(v); });
+		return out.size();
+	}
+
+	size_t split(const std::string &str, std::vector<str_view> &out) const {
+		return split(str.data(), str.size(), out);
+	}
+
+	// Parses the lines of [s, s + n) into the columns, field i of a line
+	// goes to column i. Lines end at '\n', an optional '\r' before it is
+	// dropped, and blank lines are skipped. With a single separator besides
+	// those two, e.g. '\t', every separator ends a field, so empty fields
+	// are kept, and fields are cut at raw separators with no regard to
+	// quotes; otherwise runs of separators count as one. Numbers are
+	// converted in place with from_chars. A line is appended only if it has
+	// one field per column and each of its numeric fields parses whole, the
+	// others are counted in the result.
+	template <typename ... Cs>
+	column_result split_columns(const char *s, size_t n, std::vector<Cs> &... cols) const {
+		typedef make_index_sequence<sizeof...(Cs)> indices;
+		std::tuple<std::vector<Cs> &...> cs(cols...);
+		std::tuple<Cs...> row(empty_field((Cs *)nullptr)...);
+		column_result r;
+		int sep = single_separator();
+		const char *pos = s, *end = s + n;
+		for (size_t i = 0; pos != end; ) {
+			const char *e = (const char *)memchr(pos, '\n', end - pos);
+			if ( e == nullptr ) e = end;
+			const char *p = pos, *le = e != p && *(e - 1) == '\r' ? e - 1 : e;
+			pos = e == end ? e : e + 1;
+			if ( sep < 0 ? _sep.find_not(p, le) == le : p == le ) {
+				continue;
+			}
+			bool ok = true;
+			str_view v(nullptr, nullptr);
+			parse_row(p, le, sep, row, ok, indices());
+			if ( ok && !next_field(p, le, sep, v) ) {
+				push_row(cs, row, indices());
+				++r.rows;
+			} else if ( r.rejected++ == 0 ) {
+				r.first_rejected = i;
+			}
+			++i;
+		}
+		return r;
+	}
+
+	template <typename ... Cs>
+	column_result split_columns(const std::string &str, std::vector<Cs> &... cols) const {
+		return split_columns(str.data(), str.size(), cols...);
+	}
+
+	// Splits [s, s + n) on tp, into out in input order. The input is cut
+	// into chunks at separators, and each chunk is tokenized as if its cut
+	// were a token boundary. Where that is wrong, e.g. a cut inside quotes,
+	// the seam is redone sequentially until it meets the chunk's own
+	// positions again.
+	size_t parallel_split(thread_pool &tp, const char *s, size_t n,
+			std::vector<str_view> &out, size_t nchunk = 0) const {
+		struct record {
+			const char *pos;
+			str_view v;
+		};
+		const char *end = s + n;
+		nchunk = std::max(std::min(nchunk ? nchunk : (size_t)tp.size() * 4, n / 4096), (size_t)1);
+
+		std::vector<const char *> cut(nchunk + 1, end);
+		cut[0] = s;
+		for (size_t k = 1; k < nchunk; ++k) {
+			cut[k] = std::max(cut[k - 1], _sep.find(s + n / nchunk * k, end));
+		}
+
+		std::vector<std::vector<record>> recs(nchunk);
+		std::vector<const char *> last(nchunk);
+		tp.run_njob((int)nchunk, [&] (int k) {
+			const char *pos = cut[k];
+			while ( pos < cut[k + 1] ) {
+				const char *p = pos;
+				recs[k].push_back(record{p, next_token(pos, end)});
+			}
+			last[k] = pos;
+		});
+
+		out.clear();
+		const char *q = s;
+		for (size_t k = 0; k < nchunk; ++k) {
+			const std::vector<record> &r = recs[k];
+			size_t m = 0;
+			while ( q < cut[k + 1] ) {
+				while ( m < r.size() && r[m].pos < q ) ++m;
+				if ( m < r.size() && r[m].pos == q ) {
+					for (; m < r.size(); ++m) {
+						if ( r[m].v.begin() < r[m].v.end() ) out.push_back(r[m].v);
+					}
+					q = last[k];
+					break;
+				}
+				str_view v = next_token(q, end);
+				if ( v.begin() < v.end() ) out.push_back(v);
+			}
+		}
+		return out.size();
+	}
+
 	sub_str next_token(str_iter &pos, str_iter end) const {
-		str_iter i = std::find_if_not(pos, end, _sep);
+		if ( pos == end ) {
+			return sub_str(pos, pos);
+		}
+		const char *b = &*pos, *p = b;
+		str_view t = next_token(p, b + (end - pos));
+		str_iter s = pos;
+		pos = s + (p - b);
+		return sub_str(s + (t.begin() - b), s + (t.end() - b));
+	}
+
+	str_view next_token(const char *&pos, const char *end) const {
+		const char *i = _sep.find_not(pos, end);
 		if ( i == end ) {
 			pos = i;
-			return sub_str(i, i);
+			return str_view(i, i);
 		} else if ( *i == '"' || *i == '\'' ) {
-			str_iter j = std::find(i + 1, end, *i);
+			const char *j = std::find(i + 1, end, *i);
 			while ( j != end && *(j - 1) == '\\' ) {
 				j = std::find(j + 1, end, *i);
 			}
 			pos = j == end ? j : j + 1;
-			return sub_str(i + 1, j);
+			return str_view(i + 1, j);
 		} else {
-			str_iter j = std::find_if(i + 1, end, _sep);
+			const char *j = _sep.find(i + 1, end);
 			pos = j;
-			return sub_str(i, j);
+			return str_view(i, j);
+		}
+	}
+
+private:
+	bool next_field(const char *&pos, const char *end, str_view &v) const {
+		while ( pos != end ) {
+			v = next_token(pos, end);
+			if ( v.begin() < v.end() ) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	template <typename T>
+	static T empty_field(T *) { return T(); }
+	static str_view empty_field(str_view *) { return str_view(nullptr, nullptr); }
+
+	template <typename T>
+	static bool parse_field(const str_view &v, T &x) {
+		return v.begin() != v.end() && from_chars(v.begin(), v.end(), x) == v.end();
+	}
+	static bool parse_field(const str_view &v, std::string &x) {
+		x.assign(v.begin(), v.end());
+		return true;
+	}
+	static bool parse_field(const str_view &v, str_view &x) {
+		x = v;
+		return true;
+	}
+
+	// the single field separator, not counting '\n' and '\r', or -1
+	int single_separator() const {
+		int c = -1;
+		for (size_t i = 0; i < 256; ++i) {
+			if ( i != '\n' && i != '\r' && _sep.test(i) ) {
+				if ( c >= 0 ) return -1;
+				c = (int)i;
+			}
 		}
+		return c;
+	}
+
+	// next field of the line [pos, end), with sep as by single_separator().
+	// pos is null once the line is used up
+	bool next_field(const char *&pos, const char *end, int sep, str_view &v) const {
+		if ( pos == nullptr ) {
+			return false;
+		} else if ( sep < 0 ) {
+			if ( next_field(pos, end, v) ) return true;
+			pos = nullptr;
+			return false;
+		}
+		const char *j = (const char *)memchr(pos, sep, end - pos);
+		if ( j == nullptr ) j = end;
+		v = str_view(pos, j);
+		pos = j == end ? nullptr : j + 1;
+		return true;
+	}
+
+	// ok turns false on the first field missing or not parsed whole
+	template <typename T>
+	int parse_next(const char *&pos, const char *end, int sep, T &x, bool &ok) const {
+		str_view v(nullptr, nullptr);
+		if ( ok && (ok = next_field(pos, end, sep, v)) ) {
+			ok = parse_field(v, x);
+		}
+		return 0;
+	}
+
+	template <typename ... Cs, size_t ... Is>
+	void parse_row(const char *&pos, const char *end, int sep, std::tuple<Cs...> &row,
+			bool &ok, index_sequence<Is...>) const {
+		int e[] = {parse_next(pos, end, sep, std::get<Is>(row), ok)...};
+		(void)e;
 	}
 
+	template <typename ... Cs, size_t ... Is>
+	static void push_row(std::tuple<std::vector<Cs> &...> &cols, std::tuple<Cs...> &row, index_sequence<Is...>) {
+		int e[] = {(std::get<Is>(cols).push_back(std::move(std::get<Is>(row))), 0)...};
+		(void)e;
+	}
+};
+
+
+// Splits input that arrives in chunks, with the same rules as spliter. A
+// token cut by the end of a chunk is carried over and completed by the
+// next one, so memory is bounded by the longest token. Views passed to f
+// are only valid during the call.
+class stream_spliter {
+public:
+	typedef spliter::str_view str_view;
+
+private:
+	spliter _spliter;
+	std::string _carry;
+
+public:
+	stream_spliter() = default;
+	stream_spliter(const spliter &s): _spliter(s) {}
+
+	template <typename __F>
+	void feed(const char *s, size_t n, __F &&f) {
+		const char *pos = s, *end = s + n;
+		if ( !_carry.empty() ) {
+			const char *j = complete(pos, end);
+			if ( j == nullptr ) {
+				_carry.append(pos, end);
+				return;
+			}
+			_carry.append(pos, j);
+			pos = j;
+			finish(f);
+		}
+		while ( pos != end ) {
+			const char *i = _spliter.separators().find_not(pos, end);
+			if ( i == end ) {
+				break;
+			}
+			pos = i;
+			str_view v = _spliter.next_token(pos, end);
+			if ( v.end() == end ) {
+				_carry.assign(i, end);
+				break;
+			} else if ( v.begin() < v.end() ) {
+				f(v);
+			}
+		}
+	}
+
+	template <typename __F>
+	void feed(const std::string &s, __F &&f) { feed(s.data(), s.size(), f); }
+
+	// emits the carried token at the end of input
+	template <typename __F>
+	void finish(__F &&f) {
+		if ( _carry.empty() ) {
+			return;
+		}
+		const char *p = _carry.data();
+		str_view v = _spliter.next_token(p, p + _carry.size());
+		if ( v.begin() < v.end() ) {
+			f(v);
+		}
+		_carry.clear();
+	}
+
+	const std::string &carry() const { return _carry; }
+
+private:
+	// where the carried token ends in [pos, end), nullptr if it goes on
+	const char *complete(const char *pos, const char *end) const {
+		char q = _carry.front();
+		if ( q == '"' || q == '\'' ) {
+			for (const char *j = pos; (j = std::find(j, end, q)) != end; ++j) {
+				if ( (j == pos ? _carry.back() : *(j - 1)) != '\\' ) {
+					return j + 1;
+				}
+			}
+			return nullptr;
+		}
+		const char *j = _spliter.separators().find(pos, end);
+		return j == end ? nullptr : j;
+	}
 };
 
 
@@ -114,19 +536,19 @@ private:
 	spliter _spliter = char_mask::make(" \t\r\n,;=:");
 
 public:
-	template <typename __F>
-	void parse(const std::string &str, __F &&f) const {
-		str_iter ik = str.begin();
+	template <typename __I, typename __F>
+	void parse(__I b, __I e, __F &&f) const {
+		__I ik = b;
 		auto sf = [] (char c) { return c == '=' || c == ':'; };
 		while ( true ) {
-			str_iter is = std::find_if(ik, str.end(), sf);
-			if ( is == str.end() ) {
+			__I is = std::find_if(ik, e, sf);
+			if ( is == e ) {
 				break;
 			}
-			str_iter iv = is + 1;
-			sub_str vp = _spliter.next_token(iv, str.end());
+			__I iv = is + 1;
+			auto vp = _spliter.next_token(iv, e);
 			while ( ik != is ) {
-				sub_str kp = _spliter.next_token(ik, iv);
+				auto kp = _spliter.next_token(ik, is);
 				if ( !kp.empty() ) {
 					f(kp, vp);
 				}
@@ -135,6 +557,11 @@ public:
 		}
 	}
 
+	template <typename __F>
+	void parse(const std::string &str, __F &&f) const {
+		parse(str.begin(), str.end(), f);
+	}
+
 	dictionary parse(const std::string &str) const {
 		dictionary dict;
 		parse(str, [&dict] (const sub_str &k, const sub_str &v) {
@@ -145,6 +572,129 @@ public:
 };
 
 
+// A config file mapped read only and parsed in place. Values are views into
+// the mapping, keys are interned once into a flat open addressing table and
+// can be looked up by a hash precomputed with key_hash(). The first of
+// duplicated keys wins, as with config_parser::parse().
+class mapped_config {
+public:
+	typedef spliter::str_view str_view;
+
+	static constexpr uint64_t key_hash(const char *s, uint64_t h = 14695981039346656037ULL) {
+		return *s ? key_hash(s + 1, (h ^ (unsigned char)*s) * 1099511628211ULL) : h;
+	}
+
+	static uint64_t key_hash(const char *b, const char *e) {
+		uint64_t h = 14695981039346656037ULL;
+		while ( b != e ) {
+			h = (h ^ (unsigned char)*b++) * 1099511628211ULL;
+		}
+		return h;
+	}
+
+private:
+	struct entry {
+		uint64_t hash;
+		str_view key, value;
+	};
+
+	const char *_map = nullptr;
+	size_t _size = 0;
+	std::vector<entry> _entries;
+	std::vector<uint32_t> _slots;
+
+public:
+	mapped_config() = default;
+	explicit mapped_config(const char *path) { open(path); }
+	~mapped_config() noexcept { close(); }
+
+	bool open(const char *path) {
+		close();
+		int fd = ::open(path, O_RDONLY);
+		if ( fd < 0 ) {
+			return false;
+		}
+		struct stat sb;
+		if ( fstat(fd, &sb) != 0 ) {
+			::close(fd);
+			return false;
+		}
+		if ( sb.st_size > 0 ) {
+			void *m = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if ( m != MAP_FAILED ) {
+				_map = (const char *)m;
+				_size = sb.st_size;
+			}
+		}
+		::close(fd);
+		if ( _map != nullptr ) {
+			parse();
+		}
+		return _map != nullptr || sb.st_size == 0;
+	}
+
+	void close() {
+		if ( _map != nullptr ) {
+			munmap((void *)_map, _size);
+		}
+		_map = nullptr;
+		_size = 0;
+		_entries.clear();
+		_slots.clear();
+	}
+
+	const str_view *find(uint64_t h, const char *k, size_t n) const {
+		if ( _slots.empty() ) {
+			return nullptr;
+		}
+		size_t mask = _slots.size() - 1;
+		for (size_t i = h & mask; _slots[i] != 0; i = (i + 1) & mask) {
+			const entry &e = _entries[_slots[i] - 1];
+			if ( e.hash == h && e.key.size() == n && memcmp(e.key.begin(), k, n) == 0 ) {
+				return &e.value;
+			}
+		}
+		return nullptr;
+	}
+
+	const str_view *find(const char *k, size_t n) const { return find(key_hash(k, k + n), k, n); }
+	const str_view *find(const std::string &k) const { return find(k.data(), k.size()); }
+
+	size_t size() const { return _entries.size(); }
+
+	template <typename __F>
+	void for_each(__F &&f) const {
+		for (const entry &e : _entries) {
+			f(e.key, e.value);
+		}
+	}
+
+	seal_macro_non_copy(mapped_config)
+
+private:
+	void parse() {
+		config_parser().parse(_map, _map + _size, [this] (const str_view &k, const str_view &v) {
+				_entries.push_back(entry{key_hash(k.begin(), k.end()), k, v});
+				});
+		size_t c = 16;
+		while ( c < _entries.size() * 2 ) c <<= 1;
+		_slots.assign(c, 0);
+		size_t n = 0;
+		for (size_t j = 0; j < _entries.size(); ++j) {
+			const entry &e = _entries[j];
+			if ( find(e.hash, e.key.begin(), e.key.size()) != nullptr ) {
+				continue;
+			}
+			size_t i = e.hash & (c - 1);
+			while ( _slots[i] != 0 ) i = (i + 1) & (c - 1);
+			_entries[n] = e;
+			_slots[i] = (uint32_t)++n;
+		}
+		_entries.erase(_entries.begin() + n, _entries.end());
+	}
+};
+
+
 template <typename __T>
 class config_resource {
 public:
@@ -184,13 +734,23 @@ public:
 		rs_dict_type vr;
 		cp.parse(str, [this, &vr, &set, &f] (const sub_str &k, const sub_str &v) {
 				std::string ks = k.as<std::string>();
-				std::string vs = v.as<std::string>();
 				if ( set.count(ks) > 0 ) {
-					open(vr, ks, vs, f);
+					open(vr, ks, v.as<std::string>(), f);
 				}
 			});
 	}
 
+	template <typename __S, typename __F>
+	void open(const mapped_config &mc, __F &&f, const __S &set) {
+		typedef mapped_config::str_view str_view;
+		rs_dict_type vr;
+		for (auto &k : set) {
+			if ( const str_view *v = mc.find(k) ) {
+				open(vr, k, v->as<std::string>(), f);
+			}
+		}
+	}
+
 	template <typename __F>
 	void close(__F &&f) {
 		for (auto &r : _pool) {
@@ -211,6 +771,156 @@ private:
 	}
 };
 
+
+// config_resource for readers on other threads. Readers take the current
+// snapshot without locking, reload() builds a new one and swaps it in,
+// reusing the resources of values both snapshots share, and closes the
+// rest once no reader can see the old snapshot any more. If open throws,
+// what the failed reload opened is closed again and the current snapshot
+// stays. close() must be called before destruction, as only it gets the
+// closer.
+template <typename __T>
+class concurrent_config_resource {
+public:
+	typedef __T rs_type;
+	typedef std::unordered_map<std::string, rs_type> rs_dict_type;
+	typedef concurrent_config_resource<rs_type> type;
+
+private:
+	struct snapshot {
+		config_resource<rs_type> res;
+		rs_dict_type byval;
+	};
+
+	std::atomic<const snapshot *> _cur;
+	mutable rcu_domain _rcu;
+	std::mutex _mutex;
+
+public:
+	class reader {
+	private:
+		rcu_domain &_rcu;
+		std::atomic<unsigned> *_c;
+		const snapshot *_s;
+
+	public:
+		reader(rcu_domain &d, const std::atomic<const snapshot *> &p):
+			_rcu(d), _c(d.read_lock()), _s(p.load()) {}
+		~reader() noexcept { if ( _c ) _rcu.read_unlock(_c); }
+		reader(reader &&r): _rcu(r._rcu), _c(r._c), _s(r._s) { r._c = nullptr; }
+
+		const rs_dict_type *dict() const { return _s ? &_s->res.dict() : nullptr; }
+
+		const rs_type *find(const std::string &k) const {
+			if ( !_s ) return nullptr;
+			auto f = _s->res.dict().find(k);
+			return f == _s->res.dict().end() ? nullptr : &f->second;
+		}
+
+		reader(const reader &) = delete;
+		reader &operator=(const reader &) = delete;
+	};
+
+	concurrent_config_resource(): _cur(nullptr) {}
+	~concurrent_config_resource() noexcept {
+		assert(_cur.load() == nullptr && "close() was not called");
+		delete _cur.load();
+	}
+
+	// pins the current snapshot until the reader is destroyed
+	reader read() const { return reader(_rcu, _cur); }
+
+	rs_type get(const std::string &s) const {
+		reader r = read();
+		const rs_type *p = r.find(s);
+		return p ? *p : rs_type();
+	}
+
+	template <typename __C, typename __F, typename __G>
+	void reload(const __C &cc, __F &&open, __G &&close) {
+		std::lock_guard<std::mutex> l{_mutex};
+		const snapshot *old = _cur.load();
+		std::unique_ptr<snapshot> s(new snapshot);
+		try {
+			s->res.open(cc, reuse<__F>{old, *s, open});
+		} catch ( ... ) {
+			discard(old, *s, close);
+			throw;
+		}
+		swap_in(old, s, close);
+	}
+
+	// the arguments of config_resource::open(str, f, set), then close
+	template <typename __F, typename __S, typename __G>
+	void reload(const std::string &str, __F &&open, const __S &set, __G &&close) {
+		std::lock_guard<std::mutex> l{_mutex};
+		const snapshot *old = _cur.load();
+		std::unique_ptr<snapshot> s(new snapshot);
+		try {
+			s->res.open(str, reuse<__F>{old, *s, open}, set);
+		} catch ( ... ) {
+			discard(old, *s, close);
+			throw;
+		}
+		swap_in(old, s, close);
+	}
+
+	template <typename __G>
+	void close(__G &&close) {
+		std::lock_guard<std::mutex> l{_mutex};
+		const snapshot *old = _cur.exchange(nullptr);
+		retire(old, nullptr, close);
+	}
+
+private:
+	// what config_resource calls once per distinct value: the resource of
+	// the old snapshot if it had the value, else a newly opened one
+	template <typename __F>
+	struct reuse {
+		const snapshot *old;
+		snapshot &cur;
+		__F &open;
+
+		rs_type operator()(const std::string &v) const {
+			auto o = old ? old->byval.find(v) : cur.byval.end();
+			rs_type r = old && o != old->byval.end() ? o->second : open(v);
+			cur.byval.emplace(v, r);
+			return r;
+		}
+	};
+
+	// closes what a failed reload opened, no reader has seen it
+	template <typename __G>
+	void discard(const snapshot *old, const snapshot &s, __G &&close) {
+		for (auto &kv : s.byval) {
+			if ( old == nullptr || old->byval.count(kv.first) == 0 ) {
+				close(kv.second);
+			}
+		}
+	}
+
+	template <typename __G>
+	void swap_in(const snapshot *old, std::unique_ptr<snapshot> &s, __G &&close) {
+		const snapshot *n = s.release();
+		_cur.store(n);
+		retire(old, n, close);
+	}
+
+	template <typename __G>
+	void retire(const snapshot *old, const snapshot *cur, __G &&close) {
+		if ( old == nullptr ) {
+			return;
+		}
+		_rcu.synchronize();
+		for (auto &kv : old->byval) {
+			if ( cur == nullptr || cur->byval.count(kv.first) == 0 ) {
+				close(kv.second);
+			}
+		}
+		delete old;
+	}
+};
+
 }
 
 #endif
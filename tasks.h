@@ -0,0 +1,448 @@
+
+
+#ifndef __SEAL_TASKS_H__
+#define __SEAL_TASKS_H__
+
+#include "macro.h"
+#include "threads.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+
+
+namespace sea {
+
+namespace task_impl {
+
+struct task {
+	virtual void run() = 0;
+	virtual ~task() = default;
+};
+
+template <typename F>
+struct fn_task : public task {
+	F f;
+
+	template <typename G>
+	explicit fn_task(G &&g): f(std::forward<G>(g)) {}
+
+	void run() override { f(); }
+};
+
+template <typename F>
+task *make_task(F &&f) { return new fn_task<typename std::decay<F>::type>(std::forward<F>(f)); }
+
+
+// Chase-Lev deque with the orderings of Le, Pop, Cohen and Zappa Nardelli,
+// "Correct and Efficient Work-Stealing for Weak Memory Models", PPoPP 2013.
+// The owner pushes and pops at the bottom, thieves take from the top. Grown
+// arrays are kept until the deque dies, a thief may still be reading one.
+class ws_deque {
+private:
+	struct array {
+		int64_t mask;
+		std::unique_ptr<std::atomic<task *>[]> buf;
+
+		explicit array(int64_t n): mask(n - 1), buf(new std::atomic<task *>[n]) {}
+
+		task *get(int64_t i) const { return buf[i & mask].load(std::memory_order_relaxed); }
+		void put(int64_t i, task *t) { buf[i & mask].store(t, std::memory_order_relaxed); }
+
+		array *grow(int64_t b, int64_t t) const {
+			array *a = new array((mask + 1) * 2);
+			for (int64_t i = t; i < b; ++i) {
+				a->put(i, get(i));
+			}
+			return a;
+		}
+	};
+
+	std::atomic<int64_t> _top;
+	char _pad[64 - sizeof(std::atomic<int64_t>)];
+	std::atomic<int64_t> _bottom;
+	std::atomic<array *> _array;
+	std::vector<std::unique_ptr<array>> _old;
+
+public:
+	explicit ws_deque(int64_t n = 256): _top(0), _bottom(0), _array(new array(n)) {}
+	~ws_deque() noexcept { delete _array.load(std::memory_order_relaxed); }
+
+	void push(task *x) {
+		int64_t b = _bottom.load(std::memory_order_relaxed);
+		int64_t t = _top.load(std::memory_order_acquire);
+		array *a = _array.load(std::memory_order_relaxed);
+		if ( unlikely(b - t > a->mask) ) {
+			_old.emplace_back(a);
+			a = a->grow(b, t);
+			_array.store(a, std::memory_order_release);
+		}
+		a->put(b, x);
+		_bottom.store(b + 1, std::memory_order_release);
+	}
+
+	task *pop() {
+		int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+		array *a = _array.load(std::memory_order_relaxed);
+		_bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = _top.load(std::memory_order_relaxed);
+		if ( t > b ) {
+			_bottom.store(b + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		task *x = a->get(b);
+		if ( t == b ) {
+			if ( !_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed) ) {
+				x = nullptr;
+			}
+			_bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return x;
+	}
+
+	task *steal() {
+		int64_t t = _top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = _bottom.load(std::memory_order_acquire);
+		if ( t >= b ) {
+			return nullptr;
+		}
+		task *x = _array.load(std::memory_order_acquire)->get(t);
+		if ( !_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed) ) {
+			return nullptr;
+		}
+		return x;
+	}
+
+	bool empty() const {
+		return _bottom.load(std::memory_order_relaxed) <= _top.load(std::memory_order_relaxed);
+	}
+
+	ws_deque(const ws_deque &) = delete;
+	ws_deque &operator=(const ws_deque &) = delete;
+};
+
+}
+
+
+// Work-stealing scheduler. Every worker owns a deque: tasks it spawns go to
+// its bottom and it runs them newest first, idle workers steal the oldest
+// from a random victim, and tasks from outside threads go through a shared
+// queue. Waiting through task_group::sync() or wait() runs other tasks
+// meanwhile, so nested fork-join never blocks a worker.
+//
+// A scheduler either owns n threads, or borrows the threads of a
+// thread_pool for the duration of run(). The latter has no threads of its
+// own, so tasks submitted to it only make progress inside run().
+class task_scheduler {
+private:
+	struct worker {
+		task_impl::ws_deque deque;
+	};
+
+	struct context {
+		task_scheduler *sched;
+		int id;
+	};
+
+	std::vector<std::unique_ptr<worker>> _workers;
+	std::vector<std::thread> _threads;
+	thread_pool *_pool = nullptr;
+
+	std::mutex _mutex;
+	std::condition_variable _cvar;
+	std::deque<task_impl::task *> _inject;
+	std::atomic<size_t> _injected;
+	std::atomic<unsigned> _signal;
+	std::atomic<int> _sleepers;
+	std::atomic<bool> _stop;
+
+	static constexpr int SPIN = 64;
+
+	static context &current() {
+		static thread_local context c = {nullptr, -1};
+		return c;
+	}
+
+	class scoped_context {
+	private:
+		context _saved;
+
+	public:
+		scoped_context(task_scheduler *s, int id): _saved(current()) { current() = {s, id}; }
+		~scoped_context() noexcept { current() = _saved; }
+	};
+
+public:
+	// n <= 0 takes one thread per hardware thread
+	explicit task_scheduler(int n = 0): _injected(0), _signal(0), _sleepers(0), _stop(false) {
+		if ( n <= 0 ) {
+			n = (int)std::max(std::thread::hardware_concurrency(), 1u);
+		}
+		init(n);
+		_threads.reserve(n);
+		for (int i = 0; i < n; ++i) {
+			_threads.emplace_back([this, i] {
+				scoped_context c(this, i);
+				worker_loop(i, _stop);
+			});
+		}
+	}
+
+	explicit task_scheduler(thread_pool &tp):
+		_pool(&tp), _injected(0), _signal(0), _sleepers(0), _stop(false) {
+		init(tp.size());
+	}
+
+	~task_scheduler() noexcept {
+		_stop = true;
+		wake_all();
+		for (std::thread &t : _threads) {
+			t.join();
+		}
+		for (auto &w : _workers) {
+			while ( task_impl::task *t = w->deque.pop() ) {
+				delete t;
+			}
+		}
+		for (task_impl::task *t : _inject) {
+			delete t;
+		}
+	}
+
+	int size() const { return (int)_workers.size(); }
+
+	template <typename F>
+	std::future<typename std::result_of<F ()>::type> submit(F &&f) {
+		typedef typename std::result_of<F ()>::type result_type;
+		std::packaged_task<result_type ()> p(std::forward<F>(f));
+		std::future<result_type> r = p.get_future();
+		push(task_impl::make_task(std::move(p)));
+		return r;
+	}
+
+	// waits for a future of this scheduler, running other tasks meanwhile
+	template <typename R>
+	R wait(std::future<R> &f) {
+		while ( f.wait_for(std::chrono::seconds(0)) != std::future_status::ready ) {
+			help();
+		}
+		return f.get();
+	}
+
+	// calls f as a task of the scheduler and returns once it has, borrowing
+	// the threads of the thread_pool until then
+	template <typename F>
+	void run(F &&f) {
+		if ( !_pool ) {
+			f();
+			return;
+		}
+		std::atomic<bool> done(false);
+		std::exception_ptr ep;
+		_pool->run_njob(_pool->size(), [this, &f, &done, &ep] (int i) {
+				scoped_context c(this, i);
+				if ( i == 0 ) {
+					try {
+						f();
+					} catch ( ... ) {
+						ep = std::current_exception();
+					}
+					done = true;
+					wake_all();
+				} else {
+					worker_loop(i, done);
+				}
+			});
+		if ( ep ) {
+			std::rethrow_exception(ep);
+		}
+	}
+
+	task_scheduler(const task_scheduler &) = delete;
+	task_scheduler &operator=(const task_scheduler &) = delete;
+
+private:
+	friend class task_group;
+
+	void init(int n) {
+		_workers.reserve(n);
+		for (int i = 0; i < n; ++i) {
+			_workers.emplace_back(new worker);
+		}
+	}
+
+	int current_id() {
+		const context &c = current();
+		return c.sched == this ? c.id : -1;
+	}
+
+	void push(task_impl::task *t) {
+		int id = current_id();
+		if ( id >= 0 ) {
+			_workers[id]->deque.push(t);
+		} else {
+			std::lock_guard<std::mutex> l{_mutex};
+			_inject.push_back(t);
+			++_injected;
+		}
+		++_signal;
+		if ( _sleepers.load() > 0 ) {
+			_mutex.lock();
+			_mutex.unlock();
+			_cvar.notify_one();
+		}
+	}
+
+	task_impl::task *find_task(int id) {
+		task_impl::task *t;
+		if ( id >= 0 && (t = _workers[id]->deque.pop()) ) {
+			return t;
+		}
+		if ( _injected.load(std::memory_order_relaxed) > 0 ) {
+			std::lock_guard<std::mutex> l{_mutex};
+			if ( !_inject.empty() ) {
+				t = _inject.front();
+				_inject.pop_front();
+				--_injected;
+				return t;
+			}
+		}
+		static thread_local uint32_t seed = 0x9e3779b9u ^ (uint32_t)std::hash<std::thread::id>()(std::this_thread::get_id());
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		size_t n = _workers.size();
+		for (size_t k = 0, v = seed % n; k < n; ++k, v = v + 1 == n ? 0 : v + 1) {
+			if ( (int)v != id && (t = _workers[v]->deque.steal()) ) {
+				return t;
+			}
+		}
+		return nullptr;
+	}
+
+	static void execute(task_impl::task *t) {
+		t->run();
+		delete t;
+	}
+
+	bool help() {
+		task_impl::task *t = find_task(current_id());
+		if ( t ) {
+			execute(t);
+			return true;
+		}
+		std::this_thread::yield();
+		return false;
+	}
+
+	void worker_loop(int id, std::atomic<bool> &done) {
+		int idle = 0;
+		while ( !done ) {
+			if ( task_impl::task *t = find_task(id) ) {
+				execute(t);
+				idle = 0;
+				continue;
+			} else if ( ++idle < SPIN ) {
+				std::this_thread::yield();
+				continue;
+			}
+			unsigned s = _signal.load();
+			if ( task_impl::task *t = find_task(id) ) {
+				execute(t);
+				idle = 0;
+				continue;
+			}
+			std::unique_lock<std::mutex> l{_mutex};
+			++_sleepers;
+			while ( _signal.load() == s && !done ) {
+				_cvar.wait(l);
+			}
+			--_sleepers;
+			idle = 0;
+		}
+	}
+
+	void wake_all() {
+		++_signal;
+		_mutex.lock();
+		_mutex.unlock();
+		_cvar.notify_all();
+	}
+};
+
+
+// Fork-join over a task_scheduler: spawn() queues a child and returns at
+// once, sync() runs queued tasks until every child has finished and then
+// rethrows the first exception one of them raised.
+class task_group {
+private:
+	task_scheduler &_sched;
+	std::atomic<int> _pending;
+	std::atomic<bool> _failed;
+	std::exception_ptr _error;
+
+	template <typename G>
+	struct child {
+		task_group *group;
+		G g;
+
+		void operator()() {
+			try {
+				g();
+			} catch ( ... ) {
+				if ( !group->_failed.exchange(true) ) {
+					group->_error = std::current_exception();
+				}
+			}
+			group->_pending.fetch_sub(1, std::memory_order_release);
+		}
+	};
+
+public:
+	explicit task_group(task_scheduler &s): _sched(s), _pending(0), _failed(false) {}
+	~task_group() noexcept {
+		while ( _pending.load(std::memory_order_acquire) > 0 ) {
+			_sched.help();
+		}
+	}
+
+	template <typename F>
+	void spawn(F &&f) {
+		_pending.fetch_add(1, std::memory_order_relaxed);
+		typedef child<typename std::decay<F>::type> child_type;
+		_sched.push(task_impl::make_task(child_type{this, std::forward<F>(f)}));
+	}
+
+	void sync() {
+		while ( _pending.load(std::memory_order_acquire) > 0 ) {
+			_sched.help();
+		}
+		if ( _failed ) {
+			_failed = false;
+			std::exception_ptr e;
+			std::swap(e, _error);
+			std::rethrow_exception(e);
+		}
+	}
+
+	task_group(const task_group &) = delete;
+	task_group &operator=(const task_group &) = delete;
+};
+
+}
+
+#endif // __SEAL_TASKS_H__
@@ -2,16 +2,58 @@
 #ifndef _SEAL_THREADS_H_
 #define _SEAL_THREADS_H_
 
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
 #include <functional>
 #include <mutex>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
+#include <climits>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 
 namespace sea {
 
+namespace thread_impl {
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+// sleeps while a still holds v, spurious returns included
+inline void futex_wait(std::atomic<int> &a, int v) {
+#ifdef __linux__
+	syscall(SYS_futex, reinterpret_cast<int *>(&a), FUTEX_WAIT_PRIVATE, v, nullptr, nullptr, 0);
+#else
+	(void)a;
+	(void)v;
+	std::this_thread::yield();
+#endif
+}
+
+inline void futex_wake(std::atomic<int> &a, int n) {
+#ifdef __linux__
+	syscall(SYS_futex, reinterpret_cast<int *>(&a), FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+#else
+	(void)a;
+	(void)n;
+#endif
+}
+
+}
+
 
 class spin_lock {
 private:
@@ -25,52 +67,162 @@ public:
 };
 
 
+// Grace periods for readers that never block: a reader registers on the
+// counter of the current epoch, and synchronize() flips the epoch and waits
+// until no reader is left on the old one. Whatever was unpublished before
+// synchronize() is unreachable to readers once it returns.
+class rcu_domain {
+private:
+	static constexpr size_t STRIPES = 16;
+
+	// 64 bytes apart rather than aligned, new of over-aligned types is C++17
+	struct stripe {
+		std::atomic<unsigned> n[2];
+		char pad[64 - 2 * sizeof(std::atomic<unsigned>)];
+	};
+
+	stripe _readers[STRIPES];
+	std::atomic<unsigned> _epoch;
+
+	static size_t stripe_index() {
+		static thread_local size_t i = std::hash<std::thread::id>()(std::this_thread::get_id()) % STRIPES;
+		return i;
+	}
+
+public:
+	rcu_domain(): _epoch(0) {
+		for (stripe &s : _readers) {
+			s.n[0] = 0;
+			s.n[1] = 0;
+		}
+	}
+
+	std::atomic<unsigned> *read_lock() {
+		stripe &s = _readers[stripe_index()];
+		while ( true ) {
+			unsigned e = _epoch.load();
+			s.n[e & 1].fetch_add(1);
+			if ( _epoch.load() == e ) {
+				return &s.n[e & 1];
+			}
+			s.n[e & 1].fetch_sub(1);
+		}
+	}
+
+	void read_unlock(std::atomic<unsigned> *c) { c->fetch_sub(1, std::memory_order_release); }
+
+	void synchronize() {
+		unsigned e = _epoch.fetch_add(1);
+		for (stripe &s : _readers) {
+			while ( s.n[e & 1].load(std::memory_order_acquire) != 0 ) {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	rcu_domain(const rcu_domain &) = delete;
+	rcu_domain &operator=(const rcu_domain &) = delete;
+};
+
+
+// How run_njob hands out job indices. dynamic(k) gives out k consecutive
+// jobs per claim, block() splits the jobs into one contiguous range per
+// thread, and guided(k) starts with large ranges that shrink as the jobs
+// run out, down to k. A claim is one atomic operation on a shared counter,
+// so fine-grained jobs want larger ranges.
+class schedule {
+public:
+	enum class kind {dynamic, block, guided};
+
+private:
+	kind _kind;
+	int _chunk;
+
+	schedule(kind k, int c): _kind(k), _chunk(c > 0 ? c : 1) {}
+
+public:
+	static schedule dynamic(int chunk = 1) { return schedule(kind::dynamic, chunk); }
+	static schedule block() { return schedule(kind::block, 1); }
+	static schedule guided(int min_chunk = 1) { return schedule(kind::guided, min_chunk); }
+
+	kind get_kind() const { return _kind; }
+	int chunk() const { return _chunk; }
+};
+
+
 class thread_pool {
 private:
-	std::vector<std::thread> _threads;
-	enum class command {wait, run, stop};
-	std::atomic<command> _cmd;
-	std::atomic<int> _busy;
+	static constexpr int SPIN_MIN = 1 << 6;
+	static constexpr int SPIN_MAX = 1 << 14;
 
-	std::mutex _mutex;
-	std::condition_variable _cvar;
+	std::vector<std::thread> _threads;
+	std::atomic<int> _gen;
+	std::atomic<int> _active;
+	std::atomic<int> _sleepers;
+	std::atomic<bool> _waiting;
+	std::atomic<bool> _stop;
+	int _spin_max;
 
-	const std::function<void (int)> *_func;
+	void (*_call)(void *, int, int);
+	void *_body;
 	std::atomic<int> _currj;
 	int _totalj;
+	int _chunk;
+	bool _guided;
 
 public:
-	thread_pool(int n) { extend_by(n > 0 ? n - 1 : 0); }
+	// spinning only pays when the thread being waited for runs meanwhile
+	thread_pool(int n): _gen(0), _active(0), _sleepers(0), _waiting(false), _stop(false),
+		_spin_max(std::thread::hardware_concurrency() > 1 ? SPIN_MAX : 0) {
+		extend_by(n > 0 ? n - 1 : 0);
+	}
 
 	~thread_pool() noexcept { stop(); }
 
 	void extend_by(int n) {
-		_busy = n + (int)_threads.size();
-		_cmd = command::wait;
 		_threads.reserve(n + _threads.size());
 		while ( n-- > 0 ) {
 			_threads.emplace_back(loop_wrapper, this);
 		}
-		wait_free();
 	}
 
-	void run_njob(int n, const std::function<void (int)> &f) {
-		_func = &f;
-		_currj = 0;
-		_totalj = n;
+	// The templates call f directly inside each claimed range, only the call
+	// per range goes through a pointer.
+	template <typename F>
+	void run_njob(int n, F &&f, schedule s = schedule::dynamic()) {
+		job_body<typename std::remove_reference<F>::type> b{f};
+		run_range(n, s, b);
+	}
+
+	void run_njob(int n, const std::function<void (int)> &f, schedule s = schedule::dynamic()) {
+		job_body<const std::function<void (int)>> b{f};
+		run_range(n, s, b);
+	}
+
+	void run_njob(int n, const std::function<void (int)> &&f, schedule s = schedule::dynamic()) {
+		run_njob(n, f, s);
+	}
 
-		if ( !_threads.empty() ) {
-			_cmd = command::run;
-			notify();
+	// f(b, e) runs the jobs of [b, e) in order, grain <= 0 gives every
+	// thread a single range
+	template <typename F>
+	void parallel_for(int begin, int end, int grain, F &&f) {
+		if ( end <= begin ) {
+			return;
 		}
-		do_run();
+		schedule s = grain > 0 ? schedule::dynamic(grain) : schedule::block();
+		range_body<typename std::remove_reference<F>::type> b{f, begin};
+		run_range(end - begin, s, b);
+	}
 
-		wait_free();
+	void parallel_for(int begin, int end, int grain, const std::function<void (int, int)> &f) {
+		parallel_for<const std::function<void (int, int)> &>(begin, end, grain, f);
 	}
 
-	void run_njob(int n, const std::function<void (int)> &&f) {
-		run_njob(n, f);
+	void parallel_for(int begin, int end, int grain, const std::function<void (int, int)> &&f) {
+		parallel_for(begin, end, grain, f);
 	}
+
 	void run(const std::function<void (int)> &f) {
 		run_njob((int)_threads.size(), f);
 	}
@@ -78,15 +230,18 @@ public:
 		run(f);
 	}
 
+	int size() const { return (int)_threads.size() + 1; }
+
 	void stop() {
-		_cmd = command::stop;
-		notify();
+		_stop = true;
+		++_gen;
+		thread_impl::futex_wake(_gen, INT_MAX);
 		for (std::thread &t : _threads) {
 			t.join();
 		}
 		_threads.clear();
-		_busy = 0;
-		_cmd = command::wait;
+		_stop = false;
+		++_gen;
 	}
 
 	thread_pool(const thread_pool &) = delete;
@@ -114,48 +269,137 @@ public:
 private:
 	static void loop_wrapper(thread_pool *p) { p->loop(); }
 
+	template <typename F>
+	struct job_body {
+		F &f;
+
+		void operator()(int b, int e) const {
+			for (int j = b; j < e; ++j) {
+				f(j);
+			}
+		}
+	};
+
+	template <typename F>
+	struct range_body {
+		F &f;
+		int begin;
+
+		void operator()(int b, int e) const { f(begin + b, begin + e); }
+	};
+
+	template <typename B>
+	static void call_body(void *p, int b, int e) { (*static_cast<B *>(p))(b, e); }
+
+	// A batch runs while _gen is odd. Workers spin on it for a while, for
+	// longer after spins that paid off, and then sleep on it. A worker joins a
+	// batch through _active and checks _gen again, so once the caller has
+	// made _gen even and seen _active at 0 no worker can still be using it.
 	void loop() {
-		while ( _cmd != command::stop ) {
-			if ( _cmd == command::wait ) {
-				do_wait();
-			} else if ( _cmd == command::run ) {
+		int seen = _gen.load();
+		int spin = std::min((int)SPIN_MIN, _spin_max);
+		while ( !_stop ) {
+			seen = wait_change(seen, spin);
+			if ( _stop || (seen & 1) == 0 ) {
+				continue;
+			}
+			_active.fetch_add(1);
+			if ( _gen.load() == seen ) {
 				do_run();
 			}
+			if ( _active.fetch_sub(1) == 1 && _waiting.load() ) {
+				thread_impl::futex_wake(_active, 1);
+			}
 		}
 	}
 
-	void do_wait() {
-		if ( --_busy == 0 ) {
-			notify();
+	int wait_change(int seen, int &spin) {
+		int g;
+		for (int i = 0; i < spin; ++i) {
+			if ( (g = _gen.load(std::memory_order_acquire)) != seen ) {
+				spin = std::min(spin * 2, _spin_max);
+				return g;
+			}
+			thread_impl::cpu_relax();
 		}
-		std::unique_lock<std::mutex> l{_mutex};
-		while ( _cmd == command::wait ) {
-			_cvar.wait(l);
+		spin = std::min(std::max(spin / 2, (int)SPIN_MIN), _spin_max);
+		++_sleepers;
+		while ( (g = _gen.load()) == seen ) {
+			thread_impl::futex_wait(_gen, seen);
 		}
-		++_busy;
+		--_sleepers;
+		return g;
 	}
 
-	void do_run() {
-		int j;
-		while ( (j = _currj++) < _totalj ) {
-			(*_func)(j);
+	template <typename B>
+	void run_range(int n, schedule s, B &body) {
+		int p = size();
+		_call = &call_body<B>;
+		_body = &body;
+		_currj = 0;
+		_totalj = n;
+		_guided = s.get_kind() == schedule::kind::guided;
+		_chunk = s.get_kind() == schedule::kind::block ? std::max((n + p - 1) / p, 1) : s.chunk();
+
+		// the caller takes a claim itself, wake no more workers than remain
+		int need = std::min(p - 1, (_guided ? n : (n - 1) / _chunk + 1) - 1);
+		if ( need <= 0 ) {
+			do_run();
+			return;
+		}
+		int g = (int)((unsigned)_gen.load(std::memory_order_relaxed) + 1);
+		_gen.store(g);
+		if ( _sleepers.load() > 0 ) {
+			thread_impl::futex_wake(_gen, need);
 		}
-		_cmd = command::wait;
+		do_run();
+		_gen.store((int)((unsigned)g + 1));
+		wait_idle();
 	}
 
-	void wait_free() {
-		if ( _busy > 0 ) {
-			std::unique_lock<std::mutex> l{_mutex};
-			while ( _busy > 0 ) {
-				_cvar.wait(l);
-			}
+	bool next_range(int &b, int &e) {
+		if ( _guided ) {
+			int p = size() * 2;
+			b = _currj.load(std::memory_order_relaxed);
+			int c;
+			do {
+				if ( b >= _totalj ) {
+					return false;
+				}
+				c = std::max((_totalj - b) / p, _chunk);
+			} while ( !_currj.compare_exchange_weak(b, b + std::min(c, _totalj - b)) );
+			e = b + std::min(c, _totalj - b);
+			return true;
+		}
+		if ( _currj.load(std::memory_order_relaxed) >= _totalj ) {
+			return false;
+		}
+		b = _currj.fetch_add(_chunk);
+		if ( b >= _totalj ) {
+			return false;
+		}
+		e = _totalj - b > _chunk ? b + _chunk : _totalj;
+		return true;
+	}
+
+	void do_run() {
+		int b, e;
+		while ( next_range(b, e) ) {
+			_call(_body, b, e);
 		}
 	}
 
-	void notify() {
-		_mutex.lock();
-		_mutex.unlock();
-		_cvar.notify_all();
+	void wait_idle() {
+		int a;
+		for (int i = 0; (a = _active.load()) != 0; ++i) {
+			if ( i < _spin_max ) {
+				thread_impl::cpu_relax();
+				continue;
+			}
+			_waiting = true;
+			thread_impl::futex_wait(_active, a);
+			_waiting = false;
+		}
 	}
 };
 
@@ -2,17 +2,27 @@
 #ifndef __SEAL_IO_WRITER_H__
 #define __SEAL_IO_WRITER_H__
 
+#include "charconv.h"
 #include "macro.h"
+#include "threads.h"
+#include "typetraits.h"
 
 #include <algorithm>
+#include <memory>
 #include <ostream>
 #include <string>
 #include <vector>
 
+#include <cassert>
+#include <cerrno>
+#include <climits>
 #include <cstdarg>
 #include <cstdio>
 #include <cstring>
 
+#include <sys/uio.h>
+#include <unistd.h>
+
 
 namespace sea {
 
@@ -21,6 +31,225 @@ class writer;
 seal_macro_def_has_elem(write_to);
 
 
+// A format string parsed once into literal chunks, to be reused by
+// writer::fmt(). Each "{}" takes the next argument, "{{" and "}}" are
+// literal braces. Construction parses, so it is explicit: keep the spec
+// around, e.g. in a static, rather than build one per call.
+class format_spec {
+private:
+	std::string _text;
+	std::vector<size_t> _ends;
+
+public:
+	explicit format_spec(const char *f) {
+		for (const char *p = f; *p; ++p) {
+			if ( p[0] == '{' && p[1] == '}' ) {
+				_ends.push_back(_text.size());
+				++p;
+			} else {
+				_text.push_back(*p);
+				if ( (p[0] == '{' || p[0] == '}') && p[1] == p[0] ) ++p;
+			}
+		}
+		_ends.push_back(_text.size());
+	}
+
+	size_t args() const { return _ends.size() - 1; }
+	size_t chunks() const { return _ends.size(); }
+
+	const char *chunk(size_t i) const { return _text.data() + (i == 0 ? 0 : _ends[i - 1]); }
+	size_t chunk_size(size_t i) const { return _ends[i] - (i == 0 ? 0 : _ends[i - 1]); }
+};
+
+
+namespace writer_impl {
+
+// formats into a stack buffer, or a heap one for long output, and passes the
+// result to w.write() in one piece
+template <typename W>
+void vformat_to(W &w, const char *f, va_list p) {
+	static constexpr size_t BUF = 1024;
+	char buf[BUF];
+	va_list q;
+	va_copy(q, p);
+	int n = vsnprintf(buf, BUF, f, q);
+	va_end(q);
+	if ( n < 0 ) {
+	} else if ( (size_t)n < BUF ) {
+		w.write(buf, (size_t)n);
+	} else {
+		std::unique_ptr<char []> b(new char [n + 1]);
+		vsnprintf(b.get(), n + 1, f, p);
+		w.write(b.get(), (size_t)n);
+	}
+}
+
+
+// the owner takes the spin_lock on every write, it is only ever contended
+// by another thread draining the buffer
+struct thread_buffer {
+	spin_lock lock;
+	std::string data;
+};
+
+// One buffer per thread for a writer that lets threads collect output on
+// their own. The owning thread holds the buffer's lock while it touches the
+// data. drain_lines() hands every buffer's data up to its last '\n' to
+// drain, a thread that exits hands over all of its buffer and drops it, and
+// close() hands over every one left. The buffers live in a registry shared
+// with the threads, so they stay away from a closed writer.
+class thread_buffers {
+public:
+	typedef std::function<void (const char *, size_t)> drain_type;
+
+private:
+	struct registry {
+		std::mutex mutex;
+		std::vector<std::unique_ptr<thread_buffer>> buffers;
+		drain_type drain;
+		bool closed = false;
+
+		// the owner may hold the lock over a blocking write, so yield to it
+		static void acquire(thread_buffer &b) {
+			while ( !b.lock.try_lock() ) {
+				std::this_thread::yield();
+			}
+		}
+
+		void drain_whole(thread_buffer &b) {
+			acquire(b);
+			std::lock_guard<spin_lock> g{b.lock, std::adopt_lock};
+			if ( !b.data.empty() ) {
+				drain(b.data.data(), b.data.size());
+				b.data.clear();
+			}
+		}
+
+		// with mutex held
+		void drain_all() {
+			for (auto &b : buffers) {
+				drain_whole(*b);
+			}
+		}
+
+		// with mutex held
+		void drain_lines() {
+			for (auto &b : buffers) {
+				acquire(*b);
+				std::lock_guard<spin_lock> g{b->lock, std::adopt_lock};
+				size_t i = b->data.rfind('\n');
+				if ( i != std::string::npos ) {
+					drain(b->data.data(), i + 1);
+					b->data.erase(0, i + 1);
+				}
+			}
+		}
+
+		void release(thread_buffer *b) {
+			std::lock_guard<std::mutex> l{mutex};
+			if ( closed ) return;
+			drain_whole(*b);
+			buffers.erase(std::find_if(buffers.begin(), buffers.end(),
+					[b] (const std::unique_ptr<thread_buffer> &p) { return p.get() == b; }));
+		}
+	};
+
+	struct entry {
+		uint64_t id;
+		std::weak_ptr<registry> reg;
+		thread_buffer *buf;
+	};
+
+	struct thread_entries {
+		std::vector<entry> entries;
+
+		~thread_entries() noexcept {
+			for (entry &e : entries) {
+				if ( std::shared_ptr<registry> r = e.reg.lock() ) {
+					r->release(e.buf);
+				}
+			}
+		}
+	};
+
+	struct cache_entry {
+		uint64_t id = 0;
+		thread_buffer *buf = nullptr;
+	};
+
+	std::shared_ptr<registry> _reg;
+	uint64_t _id;
+
+public:
+	explicit thread_buffers(drain_type d): _reg(std::make_shared<registry>()), _id(next_id()) {
+		_reg->drain = std::move(d);
+	}
+	~thread_buffers() noexcept {
+		std::lock_guard<std::mutex> l{_reg->mutex};
+		_reg->closed = true;
+	}
+
+	thread_buffer &local() {
+		cache_entry &c = cache();
+		if ( likely(c.id == _id) ) {
+			return *c.buf;
+		}
+		std::vector<entry> &es = entries().entries;
+		auto i = std::find_if(es.begin(), es.end(), [this] (const entry &e) { return e.id == _id; });
+		if ( i == es.end() ) {
+			es.erase(std::remove_if(es.begin(), es.end(),
+						[] (const entry &e) { return e.reg.expired(); }), es.end());
+			thread_buffer *b = new thread_buffer;
+			{
+				std::lock_guard<std::mutex> l{_reg->mutex};
+				_reg->buffers.emplace_back(b);
+			}
+			es.push_back({_id, _reg, b});
+			i = es.end() - 1;
+		}
+		c.id = _id;
+		c.buf = i->buf;
+		return *c.buf;
+	}
+
+	// drains what every thread has ended with '\n' so far
+	void drain_lines() {
+		std::lock_guard<std::mutex> l{_reg->mutex};
+		_reg->drain_lines();
+	}
+
+	// drains every buffer for the last time, drain is never called after
+	void close() {
+		std::lock_guard<std::mutex> l{_reg->mutex};
+		if ( !_reg->closed ) {
+			_reg->drain_all();
+			_reg->closed = true;
+		}
+	}
+
+	thread_buffers(const thread_buffers &) = delete;
+	thread_buffers &operator=(const thread_buffers &) = delete;
+
+private:
+	static uint64_t next_id() {
+		static std::atomic<uint64_t> n{0};
+		return ++n;
+	}
+
+	static cache_entry &cache() {
+		static thread_local cache_entry c;
+		return c;
+	}
+
+	static thread_entries &entries() {
+		static thread_local thread_entries t;
+		return t;
+	}
+};
+
+}
+
+
 class writer {
 public:
 	writer() = default;
@@ -28,18 +257,18 @@ public:
 
 	writer &write(bool b) { return write(b ? "true" : "false"); }
 
-	writer &write(short i) { return format("%d", i); }
-	writer &write(int i) { return format("%d", i); }
-	writer &write(long i) { return format("%ld", i); }
-	writer &write(long long i) { return format("%lld", i); }
+	writer &write(short i) { return write_number(i); }
+	writer &write(int i) { return write_number(i); }
+	writer &write(long i) { return write_number(i); }
+	writer &write(long long i) { return write_number(i); }
 
-	writer &write(unsigned short i) { return format("%u", i); }
-	writer &write(unsigned int i) { return format("%u", i); }
-	writer &write(unsigned long i) { return format("%lu", i); }
-	writer &write(unsigned long long i) { return format("%llu", i); }
+	writer &write(unsigned short i) { return write_number(i); }
+	writer &write(unsigned int i) { return write_number(i); }
+	writer &write(unsigned long i) { return write_number(i); }
+	writer &write(unsigned long long i) { return write_number(i); }
 
-	writer &write(float f) { return format("%g", f); }
-	writer &write(double f) { return format("%g", f); }
+	writer &write(float f) { return write_number(f); }
+	writer &write(double f) { return write_number(f); }
 	writer &write(long double f) { return format("%Lg", f); }
 
 	writer &write(const void *p) { return format("%p", p); }
@@ -53,12 +282,18 @@ public:
 		return *this;
 	}
 
+	template <typename T>
+	writer &write_number(T v) {
+		char buf[to_chars_max];
+		return write(buf, to_chars(buf, v) - buf);
+	}
+
 	writer &b() { return write(' '); }
 	writer &c() { return write(',').b(); }
 
 	void nl() {
 		write('\n');
-		flush();
+		nl_flush();
 	}
 
 
@@ -83,11 +318,23 @@ public:
 	}
 
 
+	// f must have one "{}" per argument
+	template <typename ... Ts>
+	writer &fmt(const format_spec &f, const Ts &... as) {
+		assert(f.args() == sizeof...(Ts));
+		fmt_impl(f, 0, as...);
+		return *this;
+	}
+
+
 	virtual writer &write(char c) = 0;
 	virtual writer &write(const void *, size_t) = 0;
 	virtual writer &vformat(const char *, va_list) = 0;
 	virtual writer &flush() = 0;
 
+	// called by nl(), writers that buffer may choose not to flush per line
+	virtual writer &nl_flush() { return flush(); }
+
 	size_t vformat_size(const char *f, va_list p) const {
 		va_list q;
 		va_copy(q, p);
@@ -115,6 +362,28 @@ public:
 	}
 
 	seal_macro_only_move(writer)
+
+private:
+	template <typename T, typename ... Ts>
+	void fmt_impl(const format_spec &f, size_t i, const T &a, const Ts &... as) {
+		if ( i == f.args() ) {
+			fmt_impl(f, i);
+			return;
+		}
+		if ( f.chunk_size(i) != 0 ) {
+			write(f.chunk(i), f.chunk_size(i));
+		}
+		write(a);
+		fmt_impl(f, i + 1, as...);
+	}
+
+	void fmt_impl(const format_spec &f, size_t i) {
+		for (; i < f.chunks(); ++i) {
+			if ( f.chunk_size(i) != 0 ) {
+				write(f.chunk(i), f.chunk_size(i));
+			}
+		}
+	}
 };
 
 
@@ -147,6 +416,109 @@ public:
 };
 
 
+class buffered_writer : public writer {
+private:
+	int _fd;
+	std::unique_ptr<char []> _buf;
+	size_t _cap, _len = 0;
+	bool _nlflush;
+	int _err = 0;
+
+public:
+	static constexpr size_t DEFAULT_SIZE = 1 << 16;
+
+	buffered_writer(int fd, size_t n = DEFAULT_SIZE, bool nlf = false):
+		_fd(fd), _buf(new char [std::max(n, (size_t)1)]), _cap(std::max(n, (size_t)1)), _nlflush(nlf) {}
+	buffered_writer(FILE *f, size_t n = DEFAULT_SIZE, bool nlf = false):
+		buffered_writer((fflush(f), fileno(f)), n, nlf) {}
+	~buffered_writer() noexcept { buffered_writer::flush(); }
+	using writer::write;
+	writer &write(char c) override {
+		if ( unlikely(_len == _cap) ) {
+			drain(nullptr, 0);
+		}
+		_buf[_len++] = c;
+		return *this;
+	}
+	writer &write(const void *p, size_t n) override {
+		if ( n <= _cap - _len ) {
+			memcpy(_buf.get() + _len, p, n);
+			_len += n;
+		} else if ( n < _cap / 2 ) {
+			drain(nullptr, 0);
+			memcpy(_buf.get(), p, n);
+			_len = n;
+		} else {
+			drain(p, n);
+		}
+		return *this;
+	}
+	writer &vformat(const char *f, va_list p) override {
+		va_list q;
+		va_copy(q, p);
+		size_t r = _cap - _len;
+		int n = vsnprintf(_buf.get() + _len, r, f, q);
+		va_end(q);
+		if ( n < 0 ) {
+			return *this;
+		} else if ( (size_t)n < r ) {
+			_len += n;
+		} else if ( (size_t)n < _cap ) {
+			drain(nullptr, 0);
+			_len = vsnprintf(_buf.get(), _cap, f, p);
+		} else {
+			vformat_base_impl(f, p);
+		}
+		return *this;
+	}
+	writer &flush() override {
+		drain(nullptr, 0);
+		return *this;
+	}
+	writer &nl_flush() override {
+		return _nlflush ? flush() : *this;
+	}
+
+	int fd() const { return _fd; }
+	size_t capacity() const { return _cap; }
+	size_t pending() const { return _len; }
+	bool flush_on_nl() const { return _nlflush; }
+	buffered_writer &set_flush_on_nl(bool v) { _nlflush = v; return *this; }
+	// errno of the first writev() that failed, 0 if none did. What that
+	// call had not written yet is dropped
+	int error() const { return _err; }
+
+private:
+	void drain(const void *p, size_t n) {
+		iovec iov[2] = {{_buf.get(), _len}, {const_cast<void *>(p), n}};
+		iovec *v = iov;
+		int c = n == 0 ? 1 : 2;
+		if ( _len == 0 ) {
+			++v;
+			--c;
+		}
+		while ( c > 0 ) {
+			ssize_t w = ::writev(_fd, v, c);
+			if ( w < 0 ) {
+				if ( errno == EINTR ) continue;
+				if ( _err == 0 ) _err = errno;
+				break;
+			}
+			while ( c > 0 && (size_t)w >= v->iov_len ) {
+				w -= v->iov_len;
+				++v;
+				--c;
+			}
+			if ( c > 0 ) {
+				v->iov_base = (char *)v->iov_base + w;
+				v->iov_len -= w;
+			}
+		}
+		_len = 0;
+	}
+};
+
+
 class stream_writer : public writer {
 private:
 	std::ostream &_os;
@@ -176,7 +548,10 @@ class string_writer : public writer {
 private:
 	std::string &_s;
 public:
+	static constexpr size_t FORMAT_ROOM = 256;
+
 	string_writer(std::string &s): _s(s) {}
+	string_writer(std::string &s, size_t n): _s(s) { reserve(n); }
 	~string_writer() noexcept { string_writer::flush(); }
 	using writer::write;
 	writer &write(char c) override {
@@ -184,47 +559,149 @@ public:
 		return *this;
 	}
 	writer &write(const void *p, size_t n) override {
+		reserve(n);
 		_s.append((const char *)p, n);
 		return *this;
 	}
 	writer &vformat(const char *f, va_list p) override {
-		size_t l = vformat_size(f, p) + 1;
-		if ( l != 0 ) {
-			_s.append(l, '#');
-			char *buf = &_s.front() + _s.size() - l;
-			vsprintf(buf, f, p);
-			_s.pop_back();
+		// formats into FORMAT_ROOM bytes past the end, a bounded room as
+		// resize() zero-fills it, and again only if the output is longer.
+		// The room includes the terminator, so it stays inside the size
+		size_t o = _s.size();
+		reserve(FORMAT_ROOM + 1);
+		_s.resize(o + FORMAT_ROOM + 1);
+		va_list q;
+		va_copy(q, p);
+		int n = vsnprintf(&_s[o], FORMAT_ROOM + 1, f, q);
+		va_end(q);
+		if ( n < 0 ) {
+			_s.resize(o);
+		} else if ( (size_t)n <= FORMAT_ROOM ) {
+			_s.resize(o + n);
+		} else {
+			_s.resize(o);
+			reserve(n + 1);
+			_s.resize(o + n + 1);
+			vsnprintf(&_s[o], n + 1, f, p);
+			_s.resize(o + n);
 		}
 		return *this;
 	}
 	writer &flush() override { return *this; }
+
+	// makes room for n more bytes, growing the capacity at least twofold
+	string_writer &reserve(size_t n) {
+		if ( _s.capacity() - _s.size() < n ) {
+			_s.reserve(std::max(_s.size() + n, _s.capacity() * 2));
+		}
+		return *this;
+	}
 };
 
 
 class array_writer : public writer {
 private:
 	char *_array;
+	size_t _len = 0, _cap, _size;
+	writer *_spill;
+	bool _spilled = false, _truncated = false, _eager;
+
 public:
-	array_writer(char *a): _array(a) {}
+	// unbounded, the caller guarantees the array is large enough. The
+	// terminator is written after every write
+	array_writer(char *a): _array(a), _cap((size_t)-1 / 2), _size(_cap + 1), _spill(nullptr), _eager(true) {}
+	// n is the array size, one byte of it is kept for the terminator, which
+	// is only written by flush() and c_str(). Output that does not fit is
+	// cut off, or moved with everything after it to spill when one is given.
+	// With n == 0 nothing is written to the array, not even the terminator
+	array_writer(char *a, size_t n, writer *spill = nullptr):
+		_array(a), _cap(n == 0 ? 0 : n - 1), _size(n), _spill(spill), _eager(false) {}
 	~array_writer() noexcept { array_writer::flush(); }
 	using writer::write;
 	writer &write(char c) override {
-		*_array++ = c;
-		*_array = '\0';
+		if ( likely(_len < _cap) ) {
+			_array[_len++] = c;
+			if ( _eager ) _array[_len] = '\0';
+		} else {
+			overflow(&c, 1);
+		}
 		return *this;
 	}
 	writer &write(const void *p, size_t n) override {
-		memcpy(_array, p, n);
-		_array += n;
-		*_array = '\0';
+		if ( likely(n <= _cap - _len) ) {
+			memcpy(_array + _len, p, n);
+			_len += n;
+			if ( _eager ) _array[_len] = '\0';
+		} else {
+			overflow(p, n);
+		}
 		return *this;
 	}
 	writer &vformat(const char *f, va_list p) override {
-		int n = vsprintf(_array, f, p);
-		_array += std::max(n, 0);
+		if ( !_spilled ) {
+			va_list q;
+			va_copy(q, p);
+			size_t r = std::min(_cap - _len, (size_t)INT_MAX - 1);
+			int n = _size == 0
+				? vsnprintf(nullptr, 0, f, q)
+				: vsnprintf(_array + _len, r + 1, f, q);
+			va_end(q);
+			if ( n < 0 ) {
+				return *this;
+			} else if ( (size_t)n <= r ) {
+				_len += n;
+				return *this;
+			} else if ( _spill == nullptr ) {
+				_len += r;
+				_truncated = true;
+				return *this;
+			}
+			do_spill();
+		}
+		_spill->vformat(f, p);
 		return *this;
 	}
-	writer &flush() override { return *this; }
+	writer &flush() override {
+		if ( _spilled ) {
+			_spill->flush();
+		} else if ( _size != 0 ) {
+			_array[_len] = '\0';
+		}
+		return *this;
+	}
+
+	const char *data() const { return _array; }
+	const char *c_str() {
+		flush();
+		return _array;
+	}
+	size_t size() const { return _len; }
+	size_t capacity() const { return _cap; }
+	bool truncated() const { return _truncated; }
+	bool spilled() const { return _spilled; }
+	void clear() {
+		_len = 0;
+		_cap = _size == 0 ? 0 : _size - 1;
+		_spilled = _truncated = false;
+	}
+
+private:
+	void do_spill() {
+		_spill->write(_array, _len);
+		_len = _cap = 0;
+		_spilled = true;
+	}
+
+	void overflow(const void *p, size_t n) {
+		if ( _spill != nullptr ) {
+			if ( !_spilled ) do_spill();
+			_spill->write(p, n);
+		} else {
+			memcpy(_array + _len, p, _cap - _len);
+			_len = _cap;
+			_truncated = true;
+		}
+	}
 };
 
 
@@ -288,12 +765,134 @@ public:
 		}
 		return *this;
 	}
+	writer &nl_flush() override {
+		for (writer &w : _writers) {
+			w.nl_flush();
+		}
+		return *this;
+	}
 
 	const std::vector<std::reference_wrapper<writer>> &writers() const { return _writers; }
 	std::vector<std::reference_wrapper<writer>> &writers() { return _writers; }
 };
 
 
+// Fans output out to several writers like multi_writer, but collects it
+// first and hands each target one write() per record (at nl(), flush() or
+// once limit bytes are pending). With per_thread every thread fills its own
+// buffer, so lines written by concurrent threads are never interleaved.
+// Other threads' buffers are sent by flush() up to their last '\n', and
+// whole when their thread exits.
+class fanout_writer : public writer {
+private:
+	std::vector<std::reference_wrapper<writer>> _writers;
+	size_t _limit;
+	bool _per_thread;
+	std::string _buf;
+	writer_impl::thread_buffers _buffers;
+	std::mutex _mutex;
+
+public:
+	static constexpr size_t DEFAULT_LIMIT = 1 << 16;
+
+	fanout_writer(std::initializer_list<std::reference_wrapper<writer>> ws,
+			size_t limit = DEFAULT_LIMIT, bool per_thread = false):
+		_writers(ws), _limit(limit), _per_thread(per_thread),
+		_buffers([this] (const char *p, size_t n) { locked_emit(p, n); }) {}
+	~fanout_writer() noexcept {
+		_buffers.close();
+		std::lock_guard<std::mutex> l{_mutex};
+		emit(_buf);
+		for (writer &w : _writers) {
+			w.flush();
+		}
+	}
+	using writer::write;
+	writer &write(char c) override {
+		std::unique_lock<spin_lock> g;
+		std::string &b = local(g);
+		b.push_back(c);
+		if ( unlikely(b.size() >= _limit) ) {
+			locked_emit(b);
+		}
+		return *this;
+	}
+	writer &write(const void *p, size_t n) override {
+		std::unique_lock<spin_lock> g;
+		std::string &b = local(g);
+		b.append((const char *)p, n);
+		if ( b.size() >= _limit ) {
+			locked_emit(b);
+		}
+		return *this;
+	}
+	writer &vformat(const char *f, va_list p) override {
+		writer_impl::vformat_to(*this, f, p);
+		return *this;
+	}
+	// sends the calling thread's pending output, and what other threads
+	// have ended with '\n'. Lines they are still writing stay with them
+	writer &flush() override {
+		{
+			std::unique_lock<spin_lock> g;
+			std::string &b = local(g);
+			locked_emit(b);
+		}
+		_buffers.drain_lines();
+		std::lock_guard<std::mutex> l{_mutex};
+		for (writer &w : _writers) {
+			w.flush();
+		}
+		return *this;
+	}
+	writer &nl_flush() override {
+		std::unique_lock<spin_lock> g;
+		std::string &b = local(g);
+		std::lock_guard<std::mutex> l{_mutex};
+		emit(b);
+		for (writer &w : _writers) {
+			w.nl_flush();
+		}
+		return *this;
+	}
+
+	const std::vector<std::reference_wrapper<writer>> &writers() const { return _writers; }
+
+private:
+	// with per_thread, g holds the calling thread's buffer until it is done
+	std::string &local(std::unique_lock<spin_lock> &g) {
+		if ( !_per_thread ) {
+			return _buf;
+		}
+		writer_impl::thread_buffer &b = _buffers.local();
+		g = std::unique_lock<spin_lock>(b.lock);
+		return b.data;
+	}
+
+	void locked_emit(std::string &b) {
+		locked_emit(b.data(), b.size());
+		b.clear();
+	}
+
+	void locked_emit(const char *p, size_t n) {
+		std::lock_guard<std::mutex> l{_mutex};
+		emit(p, n);
+	}
+
+	void emit(std::string &b) {
+		emit(b.data(), b.size());
+		b.clear();
+	}
+
+	void emit(const char *p, size_t n) {
+		if ( n == 0 ) return;
+		for (writer &w : _writers) {
+			w.write(p, n);
+		}
+	}
+};
+
+
 class empty_writer : public writer {
 public:
 	using writer::write;
@@ -328,6 +927,463 @@ public:
 	void clear() { _cnt = 0; }
 };
 
+
+// Hands output to a background thread that drains it into the target in
+// batches. Every thread stages what it writes in a buffer of its own, and
+// passes it on at nl() or once STAGE bytes are staged: one CAS on the head
+// of a ring of fixed size slots claims all the slots it needs. flush() also
+// passes on what other threads have staged up to their last '\n', and a
+// thread that exits passes on the rest of its stage. Lines of concurrent
+// threads are thus never interleaved, unless one is longer than STAGE and
+// gets passed on in parts. Under policy::drop each piece passed on goes
+// in whole or is counted as dropped whole, so a line passed on in parts
+// may lose some of them; a write() of STAGE bytes or more is one piece.
+class async_writer : public writer {
+public:
+	enum class policy {block, drop};
+
+private:
+	static constexpr size_t SLOT_DATA = 128 - sizeof(size_t) - sizeof(uint32_t);
+	static constexpr size_t STAGE = 8 * SLOT_DATA;
+
+	struct slot {
+		std::atomic<size_t> seq;
+		uint32_t len;
+		char data[SLOT_DATA];
+	};
+
+	writer &_target;
+	std::unique_ptr<slot []> _slots;
+	size_t _mask;
+	policy _policy;
+
+	char _pad0[64];
+	std::atomic<size_t> _head;
+	char _pad1[64 - sizeof(std::atomic<size_t>)];
+	size_t _tail = 0;
+	char _pad2[64 - sizeof(size_t)];
+	std::atomic<size_t> _dropped;
+
+	writer_impl::thread_buffers _buffers;
+
+	std::mutex _mutex;
+	std::condition_variable _cvar;
+	std::atomic<bool> _sleeping, _stop;
+	size_t _flush_req = 0, _flushed = 0;
+
+	std::thread _thread;
+
+public:
+	async_writer(writer &w, size_t n = 1 << 20, policy p = policy::block):
+		_target(w), _policy(p), _head(0), _dropped(0),
+		_buffers([this] (const char *p, size_t n) { post(p, n); }), _sleeping(false), _stop(false) {
+		size_t c = 2;
+		while ( c * SLOT_DATA < n ) c <<= 1;
+		_slots.reset(new slot [c]);
+		_mask = c - 1;
+		for (size_t i = 0; i < c; ++i) {
+			_slots[i].seq.store(i, std::memory_order_relaxed);
+		}
+		_thread = std::thread(loop_wrapper, this);
+	}
+
+	~async_writer() noexcept {
+		_buffers.close();
+		{
+			std::lock_guard<std::mutex> l{_mutex};
+			_stop = true;
+		}
+		_cvar.notify_all();
+		_thread.join();
+	}
+
+	using writer::write;
+	writer &write(char c) override {
+		writer_impl::thread_buffer &b = _buffers.local();
+		std::lock_guard<spin_lock> l{b.lock};
+		b.data.push_back(c);
+		if ( unlikely(b.data.size() >= STAGE) ) {
+			publish(b.data);
+		}
+		return *this;
+	}
+	writer &write(const void *p, size_t n) override {
+		writer_impl::thread_buffer &b = _buffers.local();
+		std::lock_guard<spin_lock> l{b.lock};
+		if ( n < STAGE ) {
+			b.data.append((const char *)p, n);
+			if ( b.data.size() >= STAGE ) {
+				publish(b.data);
+			}
+		} else {
+			publish(b.data);
+			post((const char *)p, n);
+		}
+		return *this;
+	}
+	writer &vformat(const char *f, va_list p) override {
+		writer_impl::vformat_to(*this, f, p);
+		return *this;
+	}
+	// passes on the calling thread's stage, and every line other threads
+	// have ended with '\n', and waits until they reach the target, then
+	// flushes the target. Lines other threads are still writing stay in
+	// their stages
+	writer &flush() override {
+		async_writer::nl_flush();
+		_buffers.drain_lines();
+		size_t h = _head.load(std::memory_order_acquire);
+		std::unique_lock<std::mutex> l{_mutex};
+		_flush_req = std::max(_flush_req, h);
+		_cvar.notify_all();
+		while ( _flushed < h ) {
+			_cvar.wait(l);
+		}
+		return *this;
+	}
+	// passes the calling thread's record on, without waiting for it
+	writer &nl_flush() override {
+		writer_impl::thread_buffer &b = _buffers.local();
+		std::lock_guard<spin_lock> l{b.lock};
+		publish(b.data);
+		return *this;
+	}
+
+	size_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+	writer &target() const { return _target; }
+
+private:
+	static void loop_wrapper(async_writer *w) { w->loop(); }
+
+	void publish(std::string &s) {
+		post(s.data(), s.size());
+		s.clear();
+	}
+
+	void post(const char *p, size_t n) {
+		if ( n == 0 ) {
+			return;
+		} else if ( _policy == policy::drop ) {
+			size_t k = (n + SLOT_DATA - 1) / SLOT_DATA;
+			if ( k <= _mask + 1 ) {
+				enqueue(p, n, k);
+			} else {
+				_dropped.fetch_add(n, std::memory_order_relaxed);
+			}
+			return;
+		}
+		size_t m = (_mask + 1) / 2 * SLOT_DATA;
+		while ( n > 0 ) {
+			size_t l = std::min(n, m);
+			enqueue(p, l, (l + SLOT_DATA - 1) / SLOT_DATA);
+			p += l;
+			n -= l;
+		}
+	}
+
+	void enqueue(const char *p, size_t n, size_t k) {
+		size_t pos = _head.load(std::memory_order_relaxed);
+		while ( true ) {
+			size_t last = pos + k - 1;
+			size_t seq = _slots[last & _mask].seq.load(std::memory_order_acquire);
+			if ( seq == last ) {
+				if ( _head.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed) ) {
+					break;
+				}
+			} else if ( (ptrdiff_t)(seq - last) < 0 ) {
+				if ( _policy == policy::drop ) {
+					_dropped.fetch_add(n, std::memory_order_relaxed);
+					return;
+				}
+				wake();
+				std::this_thread::yield();
+				pos = _head.load(std::memory_order_relaxed);
+			} else {
+				pos = _head.load(std::memory_order_relaxed);
+			}
+		}
+		for (size_t i = 0; i < k; ++i) {
+			slot &s = _slots[(pos + i) & _mask];
+			s.len = (uint32_t)(n < SLOT_DATA ? n : SLOT_DATA);
+			memcpy(s.data, p, s.len);
+			p += s.len;
+			n -= s.len;
+			s.seq.store(pos + i + 1, std::memory_order_release);
+		}
+		wake();
+	}
+
+	void wake() {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if ( _sleeping.load(std::memory_order_relaxed) ) {
+			std::lock_guard<std::mutex> l{_mutex};
+			_cvar.notify_all();
+		}
+	}
+
+	bool ready() const {
+		return _slots[_tail & _mask].seq.load(std::memory_order_acquire) == _tail + 1;
+	}
+
+	void loop() {
+		std::string batch;
+		while ( true ) {
+			while ( ready() ) {
+				slot &s = _slots[_tail & _mask];
+				batch.append(s.data, s.len);
+				s.seq.store(_tail + _mask + 1, std::memory_order_release);
+				++_tail;
+			}
+			if ( !batch.empty() ) {
+				_target.write(batch.data(), batch.size());
+				batch.clear();
+			}
+
+			std::unique_lock<std::mutex> l{_mutex};
+			if ( _flushed < _flush_req && _flush_req <= _tail ) {
+				_target.flush();
+				_flushed = _tail;
+				_cvar.notify_all();
+			}
+			if ( _stop && _tail == _head.load(std::memory_order_acquire) ) {
+				break;
+			}
+			_sleeping.store(true, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			while ( !ready() && !_stop && _flushed >= _flush_req
+					&& _tail == _head.load(std::memory_order_relaxed) ) {
+				_cvar.wait(l);
+			}
+			_sleeping.store(false, std::memory_order_relaxed);
+		}
+		_target.flush();
+	}
+};
+
+
+template <typename T, typename W, typename = void>
+struct has_static_write_to : public std::false_type {};
+template <typename T, typename W>
+struct has_static_write_to<T, W, typename make_void<decltype(std::declval<const T &>().write_to(std::declval<W &>()))>::type> : public std::true_type {};
+
+
+// A writer over __W's non-virtual interface, for passing static writers to
+// code that takes writer &
+template <typename __W>
+class writer_adapter : public writer {
+private:
+	__W &_w;
+public:
+	writer_adapter(__W &w): _w(w) {}
+	using writer::write;
+	writer &write(char c) override {
+		_w.write(c);
+		return *this;
+	}
+	writer &write(const void *p, size_t n) override {
+		_w.write(p, n);
+		return *this;
+	}
+	writer &vformat(const char *f, va_list p) override {
+		_w.vformat(f, p);
+		return *this;
+	}
+	writer &flush() override {
+		_w.flush();
+		return *this;
+	}
+	writer &nl_flush() override {
+		_w.nl_flush();
+		return *this;
+	}
+};
+
+
+struct string_sink {
+	std::string &s;
+	void put(char c) { s.push_back(c); }
+	void put(const char *p, size_t n) { s.append(p, n); }
+	void flush() {}
+	void nl_flush() {}
+};
+
+// stdio buffers already, so lines are not flushed one by one
+struct file_sink {
+	FILE *f;
+	void put(char c) { fputc(c, f); }
+	void put(const char *p, size_t n) { fwrite(p, 1, n, f); }
+	void flush() { fflush(f); }
+	void nl_flush() {}
+};
+
+struct writer_sink {
+	writer &w;
+	void put(char c) { w.write(c); }
+	void put(const char *p, size_t n) { w.write(p, n); }
+	void flush() { w.flush(); }
+	void nl_flush() { w.nl_flush(); }
+};
+
+
+template <typename S, typename = void>
+struct has_nl_flush : public std::false_type {};
+template <typename S>
+struct has_nl_flush<S, typename make_void<decltype(std::declval<S &>().nl_flush())>::type> : public std::true_type {};
+
+
+// Same surface as writer, dispatched statically to a sink with put(char),
+// put(const char *, size_t) and flush(), so the sink code is inlined into
+// the caller. nl() calls the sink's nl_flush() if it has one, flush() if
+// not. Objects whose write_to() accepts a basic_writer are called directly,
+// those taking writer & go through a writer_adapter.
+template <typename __Sink>
+class basic_writer {
+public:
+	typedef __Sink sink_type;
+	typedef basic_writer<sink_type> type;
+
+private:
+	sink_type _sink;
+
+public:
+	explicit basic_writer(sink_type s): _sink(std::move(s)) {}
+	~basic_writer() noexcept { flush(); }
+
+	type &write(char c) {
+		_sink.put(c);
+		return *this;
+	}
+	type &write(const void *p, size_t n) {
+		_sink.put((const char *)p, n);
+		return *this;
+	}
+
+	type &write(bool b) { return write(b ? "true" : "false"); }
+
+	type &write(short i) { return write_number(i); }
+	type &write(int i) { return write_number(i); }
+	type &write(long i) { return write_number(i); }
+	type &write(long long i) { return write_number(i); }
+
+	type &write(unsigned short i) { return write_number(i); }
+	type &write(unsigned int i) { return write_number(i); }
+	type &write(unsigned long i) { return write_number(i); }
+	type &write(unsigned long long i) { return write_number(i); }
+
+	type &write(float f) { return write_number(f); }
+	type &write(double f) { return write_number(f); }
+	type &write(long double f) { return format("%Lg", f); }
+
+	type &write(const void *p) { return format("%p", p); }
+
+	type &write(const char *s) { return write(s, strlen(s)); }
+	type &write(const std::string &s) { return write(s.data(), s.size()); }
+
+	template <typename T>
+	typename std::enable_if<has_static_write_to<T, type>::value, type &>::type
+	write(const T &o) {
+		o.write_to(*this);
+		return *this;
+	}
+
+	template <typename T>
+	typename std::enable_if<!has_static_write_to<T, type>::value
+		&& has_write_to<T, void (T::*)(writer &) const>::value, type &>::type
+	write(const T &o) {
+		writer_adapter<type> a(*this);
+		o.write_to(a);
+		return *this;
+	}
+
+	template <typename T>
+	type &write_number(T v) {
+		char buf[to_chars_max];
+		return write(buf, to_chars(buf, v) - buf);
+	}
+
+	type &b() { return write(' '); }
+	type &c() { return write(',').b(); }
+
+	void nl() {
+		write('\n');
+		nl_flush();
+	}
+
+
+	template <typename T>
+	type &operator()(const T &o) { return write(o); }
+
+	type &operator()(const char *f, ...)
+		__attribute__ ((format(printf, 2, 3))) {
+		va_list p;
+		va_start(p, f);
+		vformat(f, p);
+		va_end(p);
+		return *this;
+	}
+	type &format(const char *f, ...)
+		__attribute__ ((format(printf, 2, 3))) {
+		va_list p;
+		va_start(p, f);
+		vformat(f, p);
+		va_end(p);
+		return *this;
+	}
+
+	// f must have one "{}" per argument
+	template <typename ... Ts>
+	type &fmt(const format_spec &f, const Ts &... as) {
+		assert(f.args() == sizeof...(Ts));
+		fmt_impl(f, 0, as...);
+		return *this;
+	}
+
+	type &vformat(const char *f, va_list p) {
+		writer_impl::vformat_to(*this, f, p);
+		return *this;
+	}
+
+	type &flush() {
+		_sink.flush();
+		return *this;
+	}
+	type &nl_flush() {
+		sink_nl_flush(_sink);
+		return *this;
+	}
+
+	const sink_type &sink() const { return _sink; }
+	sink_type &sink() { return _sink; }
+
+	seal_macro_only_move(basic_writer)
+
+private:
+	template <typename S>
+	static typename std::enable_if<has_nl_flush<S>::value>::type sink_nl_flush(S &s) { s.nl_flush(); }
+	template <typename S>
+	static typename std::enable_if<!has_nl_flush<S>::value>::type sink_nl_flush(S &s) { s.flush(); }
+
+	template <typename T, typename ... Ts>
+	void fmt_impl(const format_spec &f, size_t i, const T &a, const Ts &... as) {
+		if ( i == f.args() ) {
+			fmt_impl(f, i);
+			return;
+		}
+		write(f.chunk(i), f.chunk_size(i));
+		write(a);
+		fmt_impl(f, i + 1, as...);
+	}
+
+	void fmt_impl(const format_spec &f, size_t i) {
+		for (; i < f.chunks(); ++i) {
+			write(f.chunk(i), f.chunk_size(i));
+		}
+	}
+};
+
+template <typename S>
+basic_writer<S> make_writer(S s) { return basic_writer<S>(std::move(s)); }
+
 }
 
 #endif
@@ -0,0 +1,145 @@
+#ifndef __SEAL_ZWRITER_H__
+#define __SEAL_ZWRITER_H__
+
+#include "threads.h"
+#include "writer.h"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+
+namespace sea {
+
+// Compresses everything written into gzip members of up to block bytes of
+// input each and passes them on to the target. Members are independent, so
+// the output is a plain concatenated gzip stream, and with a thread_pool
+// batch blocks at a time are compressed in parallel. Blocks are capped at
+// MAX_BLOCK, as zlib counts a buffer in 32 bits. A level outside -1..9
+// throws std::invalid_argument. A block zlib fails to compress, or runs
+// out of memory for, is dropped and error() tells why. Link with -lz.
+class gzip_writer : public writer {
+private:
+	writer &_target;
+	int _level;
+	size_t _block;
+	thread_pool *_pool;
+	std::vector<std::string> _in, _out;
+	std::vector<int> _status;
+	size_t _cur = 0;
+	int _err = Z_OK;
+
+public:
+	static constexpr size_t DEFAULT_BLOCK = 1 << 20;
+	static constexpr size_t MAX_BLOCK = 1 << 30;
+
+	gzip_writer(writer &w, int level = Z_DEFAULT_COMPRESSION, size_t block = DEFAULT_BLOCK,
+			thread_pool *tp = nullptr, size_t batch = 8):
+		_target(w), _level(level), _block(std::min(std::max(block, (size_t)1), (size_t)MAX_BLOCK)), _pool(tp),
+		_in(tp ? std::max(batch, (size_t)1) : 1), _out(_in.size()), _status(_in.size()) {
+		if ( level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION ) {
+			throw std::invalid_argument("gzip_writer: compression level out of range");
+		}
+		_in[0].reserve(_block);
+	}
+	~gzip_writer() noexcept { gzip_writer::flush(); }
+	using writer::write;
+	writer &write(char c) override {
+		std::string &b = _in[_cur];
+		b.push_back(c);
+		if ( unlikely(b.size() >= _block) ) {
+			next();
+		}
+		return *this;
+	}
+	writer &write(const void *p, size_t n) override {
+		const char *s = (const char *)p;
+		while ( n > 0 ) {
+			std::string &b = _in[_cur];
+			size_t l = std::min(n, _block - b.size());
+			b.append(s, l);
+			s += l;
+			n -= l;
+			if ( b.size() >= _block ) {
+				next();
+			}
+		}
+		return *this;
+	}
+	writer &vformat(const char *f, va_list p) override {
+		writer_impl::vformat_to(*this, f, p);
+		return *this;
+	}
+	// ends the current member, so flushing often costs compression ratio
+	writer &flush() override {
+		compress_all(_in[_cur].empty() ? _cur : _cur + 1);
+		_target.flush();
+		return *this;
+	}
+	writer &nl_flush() override { return *this; }
+
+	writer &target() const { return _target; }
+	// zlib status of the first block that failed, Z_OK if none did
+	int error() const { return _err; }
+
+private:
+	void next() {
+		if ( ++_cur == _in.size() ) {
+			compress_all(_cur);
+		} else {
+			_in[_cur].reserve(_block);
+		}
+	}
+
+	// the blocks compressed are passed on, a failed one is dropped
+	void compress_all(size_t n) {
+		if ( n > 1 && _pool ) {
+			_pool->run_njob((int)n, [this] (int i) { _status[i] = try_compress(_in[i], _out[i]); });
+		} else if ( n == 1 ) {
+			_status[0] = try_compress(_in[0], _out[0]);
+		}
+		for (size_t i = 0; i < n; ++i) {
+			if ( _status[i] == Z_OK ) {
+				_target.write(_out[i].data(), _out[i].size());
+			} else if ( _err == Z_OK ) {
+				_err = _status[i];
+			}
+			_in[i].clear();
+		}
+		_cur = 0;
+	}
+
+	// runs in pool jobs, so an exception must not get out
+	int try_compress(const std::string &in, std::string &out) const noexcept {
+		try {
+			return compress(in, out);
+		} catch ( ... ) {
+			out.clear();
+			return Z_MEM_ERROR;
+		}
+	}
+
+	int compress(const std::string &in, std::string &out) const {
+		z_stream zs = {};
+		int r = deflateInit2(&zs, _level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+		if ( r != Z_OK ) {
+			out.clear();
+			return r;
+		}
+		out.resize(deflateBound(&zs, in.size()));
+		zs.next_in = (Bytef *)in.data();
+		zs.avail_in = (uInt)in.size();
+		zs.next_out = (Bytef *)&out[0];
+		zs.avail_out = (uInt)out.size();
+		r = deflate(&zs, Z_FINISH);
+		out.resize(r == Z_STREAM_END ? zs.total_out : 0);
+		deflateEnd(&zs);
+		return r == Z_STREAM_END ? Z_OK : (r == Z_OK ? Z_BUF_ERROR : r);
+	}
+};
+
+}
+
+#endif // __SEAL_ZWRITER_H__